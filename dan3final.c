@@ -1,1338 +1,5315 @@
-/* DAN3 Encoder - Decoder (Emscripten Friendly with Debug Prints)
- * ------------
- * HISTORY
- * 20170220 - BETA
- * 20171123 - BETA (clean up)
- * 20171218 - CHANGE RLE ENCODING AND OPTION
- * 20180103 - ADD MAXIMUM BITS ALLOWED TO ENCODE OFFSET
- * 20180113 - ADD DECOMPRESSION ROUTINE
- * 20180118 - SPEED OPTIMIZATION IN COMPRESSION ROUTINE
- * 20180123 - FIX SPEED OPTIMIZATION
- * 20180126 - FIX RLE COMPRESSION
- * 20180126 - FIX READ GOLOMB VALUES
- *
- * Emscripten-specific modifications by Google Gemini (2025-07-10)
- * - Added emscripten.h and EMSCRIPTEN_KEEPALIVE.
- * - Removed file I/O (main, fopen, fclose, printf, scanf, etc.).
- * - Introduced wrapper functions (dan3_encode, dan3_decode) for JS interaction.
- * - Added extensive debug printf statements for WASM execution analysis.
- */
-#include <stdio.h>    /* For printf (debugging) */
-#include <stdlib.h>   /* malloc, free */
-#include <string.h>   /* memcpy, memset */
-#include <ctype.h>    /* tolower */
-#include <emscripten/emscripten.h> /* For EMSCRIPTEN_KEEPALIVE */
-#include <emscripten/em_asm.h> // For EM_ASM macros
-#include <emscripten/console.h> // For emscripten_console_log
-#include <stdint.h>   /* For uint8_t */
-
-/*
- * - AUTHOR'S NAME -
- */
-#define AUTHOR "Daniel Bienvenu aka NewColeco"
-/*
- * - PROGRAM TITLE -
- */
-#define PRGTITLE "DAN3 Compression Tool"
-/*
- * - VERSION NUMBER -
- */
-#define VERSION "BETA-20180126"
-/*
- * - YEAR -
- */
-#define YEAR "2018"
-/*
- * - FILE EXTENSION -
- */
-#define EXTENSION ".dan3"
-#define EXTENSIONBIN ".bin"
-/*
- * - BOOLEAN VALUES -
- */
-#define TRUE -1
-#define FALSE 0
-/*
- * - MAX INPUT FILE SIZE -
- */
-#define MAX 1024*1024 // 256KB
-/*
- * - COMPRESSION CONSTANTS -
- */
-#define BIT_GOLOMG_MAX	7
-#define MAX_GAMMA		(1<<(BIT_GOLOMG_MAX+1)) - 2
-#define BIT_OFFSET00	0
-#define BIT_OFFSET0		1
-#define BIT_OFFSET1		5
-#define BIT_OFFSET2		8
-#define BIT_OFFSET_MIN	9
-#define BIT_OFFSET_MAX	16
-#define BIT_OFFSET_NBR	BIT_OFFSET_MAX - BIT_OFFSET_MIN + 1
-
-// Mark constants with EMSCRIPTEN_KEEPALIVE if JS needs their *exact* values
-EMSCRIPTEN_KEEPALIVE const int C_BIT_OFFSET_MIN = BIT_OFFSET_MIN;
-EMSCRIPTEN_KEEPALIVE const int C_BIT_OFFSET_MAX = BIT_OFFSET_MAX;
-EMSCRIPTEN_KEEPALIVE const int C_BIT_OFFSET_NBR = BIT_OFFSET_NBR;
-EMSCRIPTEN_KEEPALIVE const int C_MAX = MAX;
-
-#define MAX_OFFSET00	(1<<BIT_OFFSET00)
-#define MAX_OFFSET0		(1<<BIT_OFFSET0) + MAX_OFFSET00
-#define MAX_OFFSET1		(1<<BIT_OFFSET1)
-#define MAX_OFFSET2		(1<<BIT_OFFSET2) + MAX_OFFSET1
-#define MAX_OFFSET		(1<<BIT_OFFSET_MAX) + MAX_OFFSET2
-#define RAW_MIN	1
-#define RAW_RANGE (1<<8)
-#define RAW_MAX RAW_MIN + RAW_RANGE - 1
-
-EMSCRIPTEN_KEEPALIVE int BIT_OFFSET3;
-EMSCRIPTEN_KEEPALIVE int MAX_OFFSET3;
-EMSCRIPTEN_KEEPALIVE int BIT_OFFSET_MAX_ALLOWED;
-EMSCRIPTEN_KEEPALIVE int BIT_OFFSET_NBR_ALLOWED;
-
-/*
- * - OPTIONS FLAGS -
- */
-// These are now set by JS wrapper functions
-EMSCRIPTEN_KEEPALIVE int bVerbose = FALSE;
-EMSCRIPTEN_KEEPALIVE int bYes = FALSE;     // Not used in WASM context
-EMSCRIPTEN_KEEPALIVE int bFAST = FALSE;
-EMSCRIPTEN_KEEPALIVE int bRLE = TRUE;
-
-/*
- * - IN-MEMORY BUFFERS -
- * These will be treated as global memory by WASM and accessed via HEAPU8/HEAP32.
- * Their addresses are accessible from JS if exported with EMSCRIPTEN_KEEPALIVE.
- */
-EMSCRIPTEN_KEEPALIVE unsigned char data_src[MAX];
-EMSCRIPTEN_KEEPALIVE int index_src;
-EMSCRIPTEN_KEEPALIVE unsigned char data_dest[MAX];
-EMSCRIPTEN_KEEPALIVE int index_dest;
-EMSCRIPTEN_KEEPALIVE unsigned char bit_mask;
-EMSCRIPTEN_KEEPALIVE int bit_index;
-
-/*
- * - MATCHES -
- */
-struct t_match
-{
-	int index;
-	struct t_match *next;
-};
-EMSCRIPTEN_KEEPALIVE struct t_match matches[65536]; // Keepalive for its internal state
-
-struct t_optimal
-{
-	int bits[BIT_OFFSET_NBR]; /* COST */
-	int offset[BIT_OFFSET_NBR];
-	int len[BIT_OFFSET_NBR];
-};
-// Make the optimals table keepalive. Its address will be _optimals in JS.
-EMSCRIPTEN_KEEPALIVE struct t_optimal optimals[MAX];
-
-/*
- * - INSERT A MATCH IN TABLE -
- */
-void insert_match(struct t_match *match, int index)
-{
-    if (bVerbose) printf("C: insert_match: index=%d\n", index);
-	struct t_match *new_match = (struct t_match *) malloc( sizeof(struct t_match) );
-    if (new_match == NULL) {
-        if (bVerbose) printf("C: CRITICAL ERROR: malloc failed in insert_match for index %d! Aborting.\n", index);
-        emscripten_console_log("C-CRITICAL: Malloc failed in insert_match!");
-        EM_ASM({ debugger; }); // Trigger JS debugger at this point
-        abort(); // Force an Emscripten-catchable abort
-    }
-	new_match->index = match->index;
-	new_match->next = match->next;
-	match->index = index;
-	match->next = new_match;
-}
-
-/*
- * - REMOVE MATCH(ES) FROM MEMORY -
- */
-void flush_match(struct t_match *match)
-{
-    if (bVerbose) printf("C: flush_match: flushing match at %p\n", (void*)match);
-	struct t_match *node;
-	struct t_match *head = match->next;
-	while ((node = head) != NULL)
-	{
-		head = head->next;
-        if (bVerbose) printf("C: flush_match: freeing node %p\n", (void*)node);
-		free(node);
-	}
-	match->next = NULL;
-}
-
-/*
- * - FREE MATCH(ES) FROM TABLE -
- */
-// This function will be called from lzss_slow.
-EMSCRIPTEN_KEEPALIVE void reset_matches(void)
-{
-    if (bVerbose) printf("C: reset_matches: Clearing all 65536 match lists\n");
-	int i;
-	for (i = 0;i < 65536;i++)
-	{
-		flush_match(&matches[i]);
-		matches[i].index = -1; // Also reset the head node's index
-	}
-}
-
-/*
- * - LOW BYTE VALUE - (Utility, might not be used directly in WASM context)
- */
-int mask_byte(int value)
-{
-	return (value & 255);
-}
-
-/*
- * - ERROR MESSAGE (EOF) - (No longer used with direct memory access)
- */
-// void error(void) { // printf("Output error\n"); exit(1); }
-
-/*
- * - READ BYTE - (Works with data_src in memory)
- */
-unsigned char read_byte()
-{
-    if (index_src < 0 || index_src >= MAX) { // This is an out-of-bounds read check
-        if (bVerbose) printf("C: CRITICAL ERROR: read_byte out of bounds! index_src=%d, MAX=%d. Aborting.\n", index_src, MAX);
-        emscripten_console_log("C-CRITICAL: Read_byte out of bounds!");
-        EM_ASM({ debugger; });
-        abort();
-    }
-	return data_src[index_src++];
-}
-
-/*
- * - READ BIT - (Works with data_src in memory)
- */
-unsigned char read_bit()
-{
-	unsigned char bit;
-    if (bit_mask == 0)
-	{
-		bit_mask  = (unsigned char) 128;
-		bit_index = index_src;
-        if (bit_index < 0 || bit_index >= MAX) { // Out of bounds for data_src access
-            if (bVerbose) printf("C: CRITICAL ERROR: read_bit (new byte) out of bounds! bit_index=%d, MAX=%d. Aborting.\n", bit_index, MAX);
-            emscripten_console_log("C-CRITICAL: Read_bit (new byte) out of bounds!");
-            EM_ASM({ debugger; });
-            abort();
-        }
-		index_src++;
-	}
-    // Check bit_index again before actual access if bit_mask was not 0
-    if (bit_index < 0 || bit_index >= MAX) { // Defensive check in case bit_index was somehow bad
-        if (bVerbose) printf("C: CRITICAL ERROR: read_bit (existing byte) out of bounds! bit_index=%d, MAX=%d. Aborting.\n", bit_index, MAX);
-        emscripten_console_log("C-CRITICAL: Read_bit (existing byte) out of bounds!");
-        EM_ASM({ debugger; });
-        abort();
-    }
-	bit = (data_src[bit_index] & bit_mask);
-	bit_mask >>= 1 ;
-	return (bit != 0 ? 1 : 0 );
-}
-
-/*
- * - READ GOLOMB GAMMA -
- */
-int read_golomb_gamma()
-{
-    if (bVerbose) printf("C: read_golomb_gamma START (index_src: %d, bit_index: %d)\n", index_src, bit_index);
-	int value = 0;
-	int i, j = 0;
-	while (j < BIT_GOLOMG_MAX && read_bit() == 0) j++;
-	if (j < BIT_GOLOMG_MAX)
-	{
-		value = 1;
-		for (i = 0; i <= j; i++)
-		{
-			value <<= 1;
-			value |= read_bit();
-		}
-	}
-	value--;
-    if (bVerbose) printf("C: read_golomb_gamma END, value: %d\n", value);
-	return value;
-}
-
-/*
- * - WRITE DATA - (Works with data_dest in memory)
- */
-void write_byte(unsigned char value)
-{
-    if (index_dest < 0 || index_dest >= MAX) { // Out of bounds write check
-        if (bVerbose) printf("C: CRITICAL ERROR: write_byte out of bounds! index_dest=%d, MAX=%d. Aborting.\n", index_dest, MAX);
-        emscripten_console_log("C-CRITICAL: Write_byte out of bounds!");
-        EM_ASM({ debugger; });
-        abort();
-    }
-	data_dest[index_dest++] = value;
-}
-
-void write_bit(int value)
-{
-	if (bit_mask == 0)
-	{
-		bit_mask  = (unsigned char) 128;
-		bit_index = index_dest;
-        if (bit_index < 0 || bit_index >= MAX) { // Out of bounds for data_dest access
-            if (bVerbose) printf("C: CRITICAL ERROR: write_bit (new byte) out of bounds! bit_index=%d, MAX=%d. Aborting.\n", bit_index, MAX);
-            emscripten_console_log("C-CRITICAL: Write_bit (new byte) out of bounds!");
-            EM_ASM({ debugger; });
-            abort();
-        }
-		write_byte((unsigned char) 0); // This internal call to write_byte will check bounds too
-	}
-    // Check bit_index again before actual access if bit_mask was not 0
-    if (bit_index < 0 || bit_index >= MAX) { // Defensive check
-        if (bVerbose) printf("C: CRITICAL ERROR: write_bit (existing byte) out of bounds! bit_index=%d, MAX=%d. Aborting.\n", bit_index, MAX);
-        emscripten_console_log("C-CRITICAL: Write_bit (existing byte) out of bounds!");
-        EM_ASM({ debugger; });
-        abort();
-    }
-	if (value) data_dest[bit_index] |= bit_mask;
-	bit_mask >>= 1 ;
-}
-
-void write_bits(int value, int size)
-{
-    if (bVerbose) printf("C: write_bits: value=0x%X, size=%d\n", value, size);
-	int i;
-	int mask = 1;
-	for (i = 0 ; i < size ; i++)
-	{
-		mask <<= 1;
-	}
-	while (mask > 1)
-	{
-		mask >>= 1;
-		write_bit (value & mask);
-	}
-}
-
-void write_golomb_gamma(int value)
-{
-    if (bVerbose) printf("C: write_golomb_gamma: value=%d\n", value);
-	int i;
-	value++;
-	for (i = 4; i <= value; i <<= 1)
-	{
-		write_bit(0);
-	}
-	while ((i >>= 1) > 0)
-	{
-		write_bit(value & i);
-	}
-}
-
-void write_offset(int value, int option)
-{
-    if (bVerbose) printf("C: write_offset: value=%d, option=%d (BIT_OFFSET3=%d)\n", value, option, BIT_OFFSET3);
-	value--;
-	if (option == 1) // For len=1 (short matches)
-	{
-		if (value >= MAX_OFFSET00)
-		{
-			write_bit(1);
-			value -= MAX_OFFSET00;
-			write_bits(value, BIT_OFFSET0);
-		}
-		else
-		{
-			write_bit(0);
-			write_bits(value, BIT_OFFSET00);
-		}
-	}
-	else // For len > 1 (longer matches)
-	{
-		if (value >= MAX_OFFSET2)
-		{
-			write_bit(1);
-			write_bit(1);
-			value -= MAX_OFFSET2;
-			write_bits(value >> BIT_OFFSET2, BIT_OFFSET3 - BIT_OFFSET2); // This subtraction needs BIT_OFFSET3 >= BIT_OFFSET2
-			write_byte((unsigned char) (value & 255)); /* BIT_OFFSET2 = 8 */
-		}
-		else
-		{
-			if (value >= MAX_OFFSET1)
-			{
-				write_bit(0);
-				value -= MAX_OFFSET1;
-				write_byte((unsigned char) (value & 255)); /* BIT_OFFSET2 = 8 */
-			}
-			else
-			{
-				write_bit(1);
-				write_bit(0);
-				write_bits(value, BIT_OFFSET1);
-			}
-		}
-	}
-}
-
-void write_doublet(int length, int offset)
-{
-    if (bVerbose) printf("C: write_doublet: len=%d, offset=%d\n", length, offset);
-	write_bit(0);
-	write_golomb_gamma(length);
-	write_offset(offset, length);
-}
-
-void write_end()
-{
-    if (bVerbose) printf("C: write_end marker\n");
-	write_bit(0);
-	write_bits(0, BIT_GOLOMG_MAX);
-	write_bit(0);
-}
-
-void write_literals_length(int length)
-{
-    if (bVerbose) printf("C: write_literals_length: len=%d\n", length);
-	write_bit(0);
-	write_bits(0, BIT_GOLOMG_MAX);
-	write_bit(1);
-	length -= RAW_MIN;
-	write_byte((unsigned char) length);
-}
-
-void write_literal(unsigned char c)
-{
-    if (bVerbose) printf("C: write_literal: char=0x%02X\n", c);
-	write_bit(1);
-	write_byte(c);
-}
-
-// write_destination is removed as file I/O is handled in JS
-// void write_destination() { // ... }
-
-// write_lz now returns the final index_dest (compressed size)
-int write_lz(int subset)
-{
-    if (bVerbose) printf("C: write_lz START for subset %d (BIT_OFFSET_MIN+%d)\n", subset, BIT_OFFSET_MIN);
-	int i, j;
-	int index;
-	index_dest = 0;
-	bit_mask = 0; // Reset bit_mask and bit_index for a new write operation
-	bit_index = 0;
-
-    if (bVerbose) printf("C: write_lz: Writing header (0xFE, subset+1)\n");
-	write_bits(0xFE, subset + 1);
-    if (bVerbose) printf("C: write_lz: Writing first raw byte 0x%02X\n", data_src[0]);
-	write_byte(data_src[0]); // First byte is always written raw
-
-	for (i = 1;i < index_src;i++)
-	{
-        // Debug check for optimistic access
-        if (i < 0 || i >= MAX) {
-            if (bVerbose) printf("C: ERROR: write_lz loop index i (%d) out of bounds (0-%d)\n", i, MAX-1);
-            // Consider returning an error or breaking.
-            return -1; // Indicate failure
-        }
-        if (optimals[i].len[subset] > 0)
-		{
-			index = i -  optimals[i].len[subset] + 1;
-            if (bVerbose) printf("C: write_lz: pos %d (src: 0x%02X), len=%d, offset=%d, type=%s\n",
-                                   i, data_src[i], optimals[i].len[subset], optimals[i].offset[subset],
-                                   optimals[i].offset[subset] == 0 ? (optimals[i].len[subset] == 1 ? "Literal" : "RLE") : "Match");
-
-            if (index < 0 || index >= MAX) {
-                if (bVerbose) printf("C: ERROR: write_lz calculated source index (%d) out of bounds!\n", index);
-                // Critical error.
-                return -1; // Indicate failure
-            }
-
-			if (optimals[i].offset[subset] == 0)
-			{
-				if (optimals[i].len[subset] == 1)
-				{
-					write_literal(data_src[index]);
-				}
-				else
-				{
-					write_literals_length(optimals[i].len[subset]);
-					for (j = 0;j < optimals[i].len[subset];j++)
-					{
-                        if (index + j >= MAX) {
-                            if (bVerbose) printf("C: ERROR: RLE loop reading data_src[%d] out of bounds!\n", index + j);
-                            return -1;
-                        }
-						write_byte(data_src[index + j]);
-					}
-				}
-			}
-			else
-			{
-				write_doublet(optimals[i].len[subset], optimals[i].offset[subset]);
-			}
-		} else {
-            // This means the current position was "skipped" or "cleaned up" as part of a previous optimal match/RLE.
-            // If bVerbose is very high, this might indicate an issue with cleanup_optimals,
-            // but generally expected if len[subset] is 0.
-            // if (bVerbose) printf("C: write_lz: Pos %d has len[subset] == 0 (skipped)\n", i);
-        }
-	}
-	write_end();
-    if (bVerbose) printf("C: write_lz END. Final index_dest: %d\n", index_dest);
-	return index_dest; // Return the compressed size
-}
-
-/*
- * - READ SOURCE - (Removed as data comes from JS memory)
- * IMPORTANT: Corrected comment to avoid nested block comments.
- */
-// unsigned char read_source() { /* ... */ } // Line 402, was problematic. Changed to //
-
-// Function Prototype: Declare golomb_gamma_bits before it's used in count_bits
-int golomb_gamma_bits(int value);
-
-/*
- * - GOLOMB GAMMA LIMIT TO 254 -
- */
-int golomb_gamma_bits(int value)
-{
-	int bits = 0;
-	value++;
-	while (value > 1)
-	{
-		bits += 2;
-		value >>= 1;
-	}
-	return bits;
-}
-
-int count_bits(int offset, int len)
-{
-    if (bVerbose) printf("C: count_bits: offset=%d, len=%d (BIT_OFFSET3=%d)\n", offset, len, BIT_OFFSET3);
-	int bits = 1 + golomb_gamma_bits(len);
-	if (len == 1)
-	{
-		if (BIT_OFFSET00 == -1) // This condition might be specific to some variant; if BIT_OFFSET00 is always 0, this branch might not be hit.
-		{
-            if (bVerbose) printf("C: count_bits (len=1, BIT_OFFSET00=-1): %d + %d = %d\n", bits, BIT_OFFSET0, bits + BIT_OFFSET0);
-			return bits + BIT_OFFSET0;
-		}
-		else
-		{
-            int offset_bits = (offset > MAX_OFFSET00 ? BIT_OFFSET0 : BIT_OFFSET00);
-            if (bVerbose) printf("C: count_bits (len=1, BIT_OFFSET00=0): %d + 1 + %d = %d (offset_bits=%d)\n", bits, offset_bits, bits + 1 + offset_bits, offset_bits);
-			return bits + 1 + offset_bits;
-		}
-	}
-    // For len > 1
-    int offset_cost;
-    if (offset > MAX_OFFSET2) {
-        offset_cost = 1 + BIT_OFFSET3;
-    } else if (offset > MAX_OFFSET1) {
-        offset_cost = BIT_OFFSET2;
-    } else {
-        offset_cost = 1 + BIT_OFFSET1;
-    }
-    if (bVerbose) printf("C: count_bits (len>1): %d + 1 + %d = %d (offset_cost=%d)\n", bits, offset_cost, bits + 1 + offset_cost, offset_cost);
-	return bits + 1 + offset_cost;
-}
-
-EMSCRIPTEN_KEEPALIVE void set_BIT_OFFSET3(int i)
-{
-    // This function can be called very frequently; verbose print might be too much.
-    // if (bVerbose) printf("C: set_BIT_OFFSET3(%d): BIT_OFFSET3=%d, MAX_OFFSET3=%d\n", i, BIT_OFFSET_MIN + i, (1 << (BIT_OFFSET_MIN + i)) + MAX_OFFSET2);
-	BIT_OFFSET3 = BIT_OFFSET_MIN + i;
-	MAX_OFFSET3 = (1 << BIT_OFFSET3) + MAX_OFFSET2;
-}
-
-void update_optimal(int index, int len, int offset)
-{
-    // This function is called for every (index, len, offset) combination.
-    // Full verbose output here will be overwhelming for large files.
-    // Only enable if debugging a very specific index.
-    // if (bVerbose) printf("C: update_optimal START: index=%d, len=%d, offset=%d\n", index, len, offset);
-
-	int i;
-	int cost;
-	i = BIT_OFFSET_NBR_ALLOWED - 1;
-	while (i >= 0)
-	{
-        // if (bVerbose) printf("C:   update_optimal: checking subset %d\n", i);
-        if (index < 0 || index >= MAX) {
-            if (bVerbose) printf("C: CRITICAL ERROR: update_optimal index (%d) out of bounds for optimals array! Aborting.\n", index);
-            emscripten_console_log("C-CRITICAL: update_optimal index OOB!");
-            EM_ASM({ debugger; });
-            abort();
-        }
-
-		if (offset == 0) // Literal or RLE
-		{
-			if (index > 0)
-			{
-                int prev_bits_idx = (index - 1);
-                // Defensive check before accessing optimals[index-1]
-                if (prev_bits_idx < 0 || prev_bits_idx >= MAX) {
-                    if (bVerbose) printf("C: CRITICAL ERROR: update_optimal prev_bits_idx (%d) out of bounds for optimals array! Aborting.\n", prev_bits_idx);
-                    emscripten_console_log("C-CRITICAL: update_optimal prev_bits_idx OOB!");
-                    EM_ASM({ debugger; });
-                    abort();
-                }
-                if (optimals[index-1].bits[i] == 0x7FFFFFFF) { // If previous state is unreachable
-                    // if (bVerbose) printf("C:     update_optimal: prev state (index-1) unreachable for subset %d\n", i);
-                    i--;
-                    continue;
-                }
-
-				if (len == 1)
-				{
-					// Literal: cost = previous_cost + 1_bit_flag + 8_bits_data
-					cost = optimals[prev_bits_idx].bits[i] + 1 + 8;
-					if (optimals[index].bits[i] > cost)
-					{
-                        // if (bVerbose) printf("C:       update_optimal: Literal improved for subset %d, cost %d -> %d\n", i, optimals[index].bits[i], cost);
-					    optimals[index].bits[i] = cost;
-					    optimals[index].offset[i] = 0;
-					    optimals[index].len[i] = 1;
-                    }
-				}
-				else // RLE
-				{
-                    int prev_len_bits_idx = (index - len);
-                    // Defensive check before accessing optimals[index-len]
-                    if (prev_len_bits_idx < 0 || prev_len_bits_idx >= MAX) {
-                        if (bVerbose) printf("C: CRITICAL ERROR: update_optimal prev_len_bits_idx (%d) out of bounds for optimals array! Aborting.\n", prev_len_bits_idx);
-                        emscripten_console_log("C-CRITICAL: update_optimal prev_len_bits_idx OOB!");
-                        EM_ASM({ debugger; });
-                        abort();
-                    }
-                    if (optimals[prev_len_bits_idx].bits[i] == 0x7FFFFFFF) { // If previous RLE base state unreachable
-                        // if (bVerbose) printf("C:     update_optimal: prev RLE state (index-len=%d) unreachable for subset %d\n", prev_len_bits_idx, i);
-                        i--;
-                        continue;
-                    }
-					cost = optimals[prev_len_bits_idx].bits[i] + 1 + BIT_GOLOMG_MAX + 1 + 8 + len * 8;
-					if (optimals[index].bits[i] > cost)
-					{
-                        // if (bVerbose) printf("C:       update_optimal: RLE len=%d improved for subset %d, cost %d -> %d\n", len, i, optimals[index].bits[i], cost);
-						optimals[index].bits[i] = cost;
-						optimals[index].offset[i] = 0;
-						optimals[index].len[i] = len;
-					}
-				}
-			}
-			else // index == 0 (first byte)
-			{
-				optimals[index].bits[i] = 8;
-				optimals[index].offset[i] = 0;
-				optimals[index].len[i] = 1;
-                // if (bVerbose) printf("C:       update_optimal: First byte, cost = 8 for subset %d\n", i);
-			}
-		}
-		else // Match
-		{
-			if (offset > index) { // Invalid offset (match goes before start of data_src)
-                if (bVerbose) printf("C:     update_optimal: Match offset %d > index %d, invalid for subset %d\n", offset, index, i);
-				i--;
-				continue;
-			}
-
-            int prev_match_bits_idx = (index - len);
-            // Defensive check before accessing optimals[index-len]
-            if (prev_match_bits_idx < 0 || prev_match_bits_idx >= MAX) {
-                if (bVerbose) printf("C: CRITICAL ERROR: update_optimal prev_match_bits_idx (%d) out of bounds for optimals array! Aborting.\n", prev_match_bits_idx);
-                emscripten_console_log("C-CRITICAL: update_optimal prev_match_bits_idx OOB!");
-                EM_ASM({ debugger; });
-                abort();
-            }
-            if (optimals[prev_match_bits_idx].bits[i] == 0x7FFFFFFF) { // If previous match base state unreachable
-                // if (bVerbose) printf("C:     update_optimal: prev match state (index-len=%d) unreachable for subset %d\n", prev_match_bits_idx, i);
-                i--;
-                continue;
-            }
-
-			if (offset > MAX_OFFSET1)
-			{
-				set_BIT_OFFSET3(i);
-				if (offset > MAX_OFFSET3) {
-                    if (bVerbose) printf("C:     update_optimal: Match offset %d > MAX_OFFSET3 (%d) for subset %d. Skipping.\n", offset, MAX_OFFSET3, i);
-                    i--; // Decrement i before continuing the loop
-                    continue; // Offset too large for this subset, try next subset
-                }
-			}
-			cost = optimals[prev_match_bits_idx].bits[i] + count_bits(offset, len);
-			if (optimals[index].bits[i] > cost)
-			{
-                // if (bVerbose) printf("C:       update_optimal: Match len=%d offset=%d improved for subset %d, cost %d -> %d\n", len, offset, i, optimals[index].bits[i], cost);
-				optimals[index].bits[i] = cost;
-				optimals[index].offset[i] = offset;
-				optimals[index].len[i] = len;
-			}
-		}
-		i--;
-	}
-    // if (bVerbose) printf("C: update_optimal END.\n");
-}
-
-/*
- * - REMOVE USELESS FOUND OPTIMALS -
- */
-EMSCRIPTEN_KEEPALIVE void cleanup_optimals(int subset)
-{
-    if (bVerbose) printf("C: cleanup_optimals START for subset %d (index_src=%d)\n", subset, index_src);
-	int j;
-	int i = index_src - 1;
-	int len;
-	while (i > 1) // Loop from end backwards
-	{
-        if (i < 0 || i >= MAX) {
-            if (bVerbose) printf("C: ERROR: cleanup_optimals loop index i (%d) out of bounds (0-%d)\n", i, MAX-1);
-            break; // Stop processing this optimal
-        }
-        if (subset < 0 || subset >= BIT_OFFSET_NBR) {
-            if (bVerbose) printf("C: ERROR: cleanup_optimals subset (%d) out of bounds (0-%d)\n", subset, BIT_OFFSET_NBR-1);
-            break; // Stop processing
-        }
-
-		len = optimals[i].len[subset];
-        // if (bVerbose) printf("C:   cleanup_optimals: at index %d, len = %d\n", i, len);
-
-        if (len <= 0) { // If it's a literal or already cleaned up
-             i--; // Move to previous position
-             continue; // Nothing to clean before this point related to this segment
-        }
-
-		for (j = i - 1; j > i - len;j--) // Clean up positions covered by this optimal token
-		{
-            if (j < 0 || j >= MAX) {
-                if (bVerbose) printf("C: ERROR: cleanup_optimals inner loop index j (%d) out of bounds!\n", j);
-                break; // Prevent crash
-            }
-            if (optimals[j].offset[subset] != 0 || optimals[j].len[subset] != 0) {
-                 if (bVerbose) printf("C:     cleanup_optimals: Clearing index %d (was offset=%d, len=%d)\n", j, optimals[j].offset[subset], optimals[j].len[subset]);
-            }
-			optimals[j].offset[subset] = 0;
-			optimals[j].len[subset] = 0;
-		}
-		i = i - len; // Jump back to the start of the current optimal token
-	}
-    if (bVerbose) printf("C: cleanup_optimals END.\n");
-}
-
-/* DAN3 Encoder - Decoder (Emscripten Friendly with Debug Prints)
- * Fixed bounds checking issue in LZ MATCH OF 2+ section
- * The key fix: Move bounds checking BEFORE calling update_optimal()
- */
-
-// ... [Keep all the existing includes and defines as they are] ...
-
-// In the lzss_slow() function, replace the problematic section with this fixed version:
-
-int lzss_slow()
-{
-    if (bVerbose) printf("C: lzss_slow START. index_src: %d, bRLE: %d, bFAST: %d\n", index_src, bRLE, bFAST);
-	int best_len;
-	int len;
-	int i, j, k;
-	int offset;
-	int match_index, prev_match_index = -1;
-	int bits_minimum_temp, bits_minimum;
-	struct t_match *match;
-
-    // Reset internal state for a fresh compression run
-    reset_matches();
-    // Initialize optimals table with a very large value (effectively Infinity)
-    if (bVerbose) printf("C: lzss_slow: Initializing optimals table...\n");
-    for(int x = 0; x < MAX; x++) { // Loop up to MAX, as index_src might be smaller
-        for(int y = 0; y < BIT_OFFSET_NBR; y++) {
-            optimals[x].bits[y] = 0x7FFFFFFF; // Max signed 32-bit int, acts as Infinity
-            optimals[x].offset[y] = 0;
-            optimals[x].len[y] = 0;
-        }
-    }
-    // Initialize the first byte
-    if (index_src > 0) {
-        update_optimal(0, 1, 0);
-    } else {
-        if (bVerbose) printf("C: lzss_slow: index_src is 0, nothing to compress.\n");
-        return 0; // Return 0 length if input is empty
-    }
-
-	i = 1;
-	while (i < index_src)
-	{
-		if (bVerbose && (i % 1000 == 0 || i == index_src - 1)) {
-            printf("C: lzss_slow: Scan progress %d/%d bytes\n", i + 1, index_src);
-        }
-		/* TRY LITERALS */
-		update_optimal(i, 1, 0);
-
-		/* STRING OF LITERALS (RLE) */
-		if (bRLE)
-		{
-			if (i >= RAW_MIN)
-			{
-				j = RAW_MAX;
-				if (j > i) j = i;
-				if (RAW_MIN == 1)
-				{
-					for (k = j ; k > RAW_MIN; k--)
-					{
-						update_optimal(i, k, 0);
-					}
-				}
-				else
-				{
-					/* RAW MINIMUM > 1 */
-					for (k = j ; k >= RAW_MIN; k--)
-					{
-						update_optimal(i, k, 0);
-					}
-				}
-			}
-		}
-
-		/* LZ MATCH OF 1 */
-		j = (BIT_OFFSET00 == -1 ? (1 << BIT_OFFSET0) : MAX_OFFSET0);
-		if (j > i) j = i;
-		for (k = 1; k <= j; k++)
-		{
-            // Check data_src bounds before access in LZ MATCH OF 1
-            if (i < 0 || i >= MAX || (i - k) < 0 || (i - k) >= MAX) {
-                if (bVerbose) printf("C: CRITICAL ERROR: LZ MATCH OF 1 data_src[%d] or data_src[%d] out of bounds (i=%d, k=%d)! Aborting.\n", i, i-k, i, k);
-                emscripten_console_log("C-CRITICAL: LZ MATCH OF 1 OOB!");
-                EM_ASM({ debugger; });
-                abort();
-            }
-			if (data_src[i] == data_src[i-k])
-			{
-				update_optimal(i, 1, k);
-			}
-		}
-
-		/* LZ MATCH OF 2+ - FIXED VERSION */
-        if (i -1 < 0 || i >= MAX) { // Defensive check for data_src[i-1]
-            if (bVerbose) printf("C: ERROR: LZ MATCH OF 2+ (i=%d) out of bounds for data_src[%d]\n", i, i-1);
-            // Potentially return error.
-            prev_match_index = -1; // Cannot process, reset
-        } else {
-		    match_index = ((int) data_src[i-1]) << 8 | ((int) data_src[i] & 255);
-		    match = &matches[match_index];
-
-		    if (prev_match_index == match_index && bFAST == TRUE && optimals[i-1].offset[0] == 1 && optimals[i-1].len[0] > 2)
-		    {
-			    len = optimals[i-1].len[0];
-			    if (len < MAX_GAMMA)
-                {
-                    // BOUNDS CHECK BEFORE update_optimal call
-                    if (i >= len && i - len >= 0 && i - len < MAX) {
-				        update_optimal(i, len + 1, 1);
-                    }
-                }
-		    }
-		    else
-		    {
-			    best_len = 1;
-			    for (;match->next != NULL; match = match->next)
-			    {
-				    offset = i - match->index;
-				    if (offset > MAX_OFFSET)
-				    {
-					    flush_match(match); // Remove old matches
-					    break;
-				    }
-                    if (offset <= 0 || i - offset < 0) { // Defensive check for offset validity
-                        if (bVerbose) printf("C: ERROR: LZ MATCH OF 2+ (i=%d, offset=%d) invalid for match. Skipping.\n", i, offset);
-                        continue;
-                    }
-				    
-                    // FIXED: Check bounds BEFORE trying different lengths
-				    for (len = 2; len <= MAX_GAMMA; len++)
-				    {
-                        // CRITICAL FIX: Move bounds check BEFORE update_optimal call
-                        if (i - len < 0 || (i - len - offset) < 0 || (i - len) >= MAX || (i - len - offset) >= MAX) {
-                            if (bVerbose) printf("C: BOUNDS: LZ MATCH OF 2+ would access out of bounds for len=%d, offset=%d at i=%d. Breaking.\n", len, offset, i);
-                            break; // Stop trying longer lengths for this offset
-                        }
-                        
-                        // Now it's safe to call update_optimal
-					    update_optimal(i, len, offset);
-					    best_len = len;
-                        
-                        // Check if the match continues (this is the original match verification logic)
-					    if (i < offset + len || data_src[i-len] != data_src[i-len-offset])
-					    {
-						    break;
-					    }
-				    }
-				    if (bFAST && best_len > 255) break;
-			    }
-		    }
-		    prev_match_index = match_index;
-		    insert_match(&matches[match_index], i);
-        }
-		i++;
-	}
-    if (bVerbose) printf("C: lzss_slow: Scan done.\n");
-
-    // Select the best subset
-    if (index_src <= 0) { // Handle empty input gracefully after scan
-        if (bVerbose) printf("C: lzss_slow: Empty input after scan, returning 0.\n");
-        return 0; // Return 0 length if input is empty
-    }
-
-	bits_minimum = optimals[index_src-1].bits[0];
-    if (optimals[index_src-1].bits[0] == 0x7FFFFFFF) {
-        if (bVerbose) printf("C: lzss_slow: Subset 0 is unreachable at end. Trying others.\n");
-    }
-
-	j = 0; // j will hold the index of the best subset based on bits_minimum
-	for (i = 0;i < BIT_OFFSET_NBR_ALLOWED;i++)
-	{
-		bits_minimum_temp = optimals[index_src-1].bits[i];
-        if (bits_minimum_temp == 0x7FFFFFFF) { // If this subset is unreachable
-            if (bVerbose) printf("C: lzss_slow: Subset %d is unreachable.\n", i);
-            continue;
-        }
-        if (bVerbose) printf("C: lzss_slow: Subset %d (%d bits) cost: %d\n", i, BIT_OFFSET_MIN + i, bits_minimum_temp);
-
-		if (bits_minimum_temp < bits_minimum)
-		{
-			bits_minimum = bits_minimum_temp;
-			j = i;
-		}
-	}
-    if (bVerbose) printf("C: lzss_slow: Best subset chosen: %d (offset_bits: %d) with %d bits.\n", j, BIT_OFFSET_MIN + j, bits_minimum);
-
-    if (bits_minimum == 0x7FFFFFFF) { // If even the "best" subset is unreachable
-        if (bVerbose) printf("C: ERROR: lzss_slow: All subsets unreachable. Cannot compress.\n");
-        return -1; // Indicate failure
-    }
-
-	set_BIT_OFFSET3(j); // Set globals based on the chosen optimal subset
-	cleanup_optimals(j); // Clean up based on the chosen optimal subset
-	return write_lz(j); // Write the compressed data and return its size
-}
-
-/* 
- * KEY CHANGES MADE:
- * 
- * 1. CRITICAL FIX: Moved the bounds checking BEFORE the update_optimal() call in the LZ MATCH OF 2+ section
- * 2. Added proper bounds checking for the fast path optimization case
- * 3. Changed the bounds check behavior from abort() to break, allowing the algorithm to continue with shorter lengths
- * 4. Added more defensive programming for edge cases
- * 
- * The main issue was that update_optimal() was being called with potentially invalid parameters,
- * and it would try to access the optimals array with out-of-bounds indices before the bounds check
- * could catch the problem. Now the bounds are verified first, making the code much safer.
- */
-
-/*
- * - DECOMPRESSION LOGIC - (Core decompression logic)
- */
-int delzss()
-{
-    if (bVerbose) printf("C: delzss START. index_src (compressed_len): %d\n", index_src);
-	int	subset = 0;
-	int old_index_src = index_src; // Total length of compressed input
-	int len, offset;
-	int i;
-
-	// Reset bit counters for reading
-	index_src = 0; // Reset index_src to start of compressed data
-	bit_mask = 0;
-	bit_index = 0;
-
-	// Read subset header
-    if (old_index_src <= 0) {
-        if (bVerbose) printf("C: delzss: Empty compressed input.\n");
-        return 0;
-    }
-    if (index_src >= old_index_src) { // Check if we ran out of input after header
-        if (bVerbose) printf("C: delzss: Compressed input too short to read header.\n");
-        return -1; // Error
-    }
-    if (bVerbose) printf("C: delzss: Reading subset header (index_src: %d, old_index_src: %d)...\n", index_src, old_index_src);
-	while (read_bit() != 0)
-	{
-		subset++;
-        if (subset > BIT_OFFSET_NBR || index_src >= old_index_src) { // Prevent infinite loop or OOB read
-            if (bVerbose) printf("C: ERROR: delzss: Subset header read too long or OOB!\n");
-            return -1;
-        }
-	}
-    if (bVerbose) printf("C: delzss: Selected subset %d (offset_bits %d).\n", subset, subset + BIT_OFFSET_MIN);
-
-	// First byte raw
-	index_dest = 0; // Reset index_dest for writing decompressed data
-    if (index_src >= old_index_src) { // Check if we ran out of input after header
-        if (bVerbose) printf("C: ERROR: delzss: Compressed input too short after subset header to read first byte.\n");
-        return -1;
-    }
-    unsigned char first_byte = read_byte();
-	write_byte(first_byte);
-    if (bVerbose) printf("C: delzss: Wrote first byte: 0x%02X at index_dest %d\n", first_byte, index_dest - 1);
-
-
-	while (index_src < old_index_src) // Loop until end of compressed input
-	{
-        if (bVerbose && index_dest % 1000 == 0) {
-            printf("C: delzss: Decompression progress: %d bytes decompressed\n", index_dest);
-        }
-        if (index_src >= old_index_src) { // Check for read_bit, read_byte from OOB
-            if (bVerbose) printf("C: delzss: End of compressed data reached unexpectedly.\n");
-            break;
-        }
-		if (read_bit()) // Is next byte literal or match (1=literal, 0=match/RLE/End)
-		{
-			/* LITERAL */
-            if (index_src >= old_index_src) {
-                if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for literal byte.\n");
-                return -1;
-            }
-            unsigned char lit_byte = read_byte();
-			write_byte(lit_byte);
-            if (bVerbose) printf("C: delzss: Decompressed literal byte 0x%02X at index_dest %d\n", lit_byte, index_dest - 1);
-		}
-		else // Match, RLE, or End marker
-		{
-			len = read_golomb_gamma();
-            if (bVerbose) printf("C: delzss: Read golomb gamma len: %d\n", len);
-			if (len == -1) // Special code / End marker
-			{
-                if (index_src >= old_index_src) {
-                    if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for end/RLE flag.\n");
-                    return -1;
-                }
-				if (read_bit() == 0) // End marker (0 0s, then 0)
-				{
-                    if (bVerbose) printf("C: delzss: End marker reached.\n");
-					break; // EOF
-				}
-				else // RLE (0 0s, then 1)
-				{
-                    if (index_src >= old_index_src) {
-                        if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for RLE length byte.\n");
-                        return -1;
-                    }
-					len = read_byte() + 1; // Actual RLE length
-                    if (bVerbose) printf("C: delzss: Decompressing RLE of length %d\n", len);
-					for (i = 0; i < len; i++)
-					{
-                        if (index_src >= old_index_src) {
-                            if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for RLE data byte %d/%d.\n", i, len);
-                            return -1;
-                        }
-						write_byte(read_byte());
-					}
-				}
-			}
-			else // Match
-			{
-				offset = 0;
-                if (bVerbose) printf("C: delzss: Decoding match (len=%d)...\n", len);
-
-				if (len == 1) // Match length 1
-				{
-                    if (index_src >= old_index_src) {
-                        if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for match offset bit (len=1).\n");
-                        return -1;
-                    }
-					if (read_bit()) // Read 1 bit for short offset
-					{
-						offset = read_bit() + 1;
-					} else {
-                        offset = 0; // If len is 1 and first offset bit is 0, offset is 0. This seems unusual for LZSS matches.
-                    }
-                    if (bVerbose) printf("C: delzss: Match (len=1) offset: %d\n", offset);
-				}
-				else // Match length > 1
-				{
-                    if (index_src >= old_index_src) {
-                        if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for match offset type bit (len>1).\n");
-                        return -1;
-                    }
-					if (!read_bit()) // Read 1 bit for offset type (0 = 8-bit offset, 1 = longer offset)
-					{
-						/* 8bit offset */
-                        if (index_src >= old_index_src) {
-                            if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for 8-bit offset byte.\n");
-                            return -1;
-                        }
-						offset = read_byte() + 32; // This '32' constant implies a specific offset base
-                        if (bVerbose) printf("C: delzss: Match (len=%d) 8-bit offset: %d\n", len, offset);
-					}
-					else // Longer offset encoding (first bit was 1)
-					{
-                        if (index_src >= old_index_src) {
-                            if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for long offset type bit.\n");
-                            return -1;
-                        }
-						if (read_bit()) // If second bit is 1 (1 1 = very long offset)
-						{
-                            if (bVerbose) printf("C: delzss: Match (len=%d) very long offset (subset=%d, BIT_OFFSET_MIN=%d)\n", len, subset, BIT_OFFSET_MIN);
-							for (i = 0;i < subset + BIT_OFFSET_MIN - 8;i++) // Read remaining bits for the full offset value
-							{
-                                if (index_src >= old_index_src) {
-                                    if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for long offset bit %d/%d.\n", i, subset + BIT_OFFSET_MIN - 8);
-                                    return -1;
-                                }
-								offset <<= 1;
-								offset |= read_bit();
-							}
-                            if (index_src >= old_index_src) {
-                                if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for long offset byte.\n");
-                                return -1;
-                            }
-							offset <<= 8; // Shift to make room for the byte
-							offset |= read_byte(); // Read the byte part
-							offset += 256 + 32; // Add base offset
-                            if (bVerbose) printf("C: delzss: Match (len=%d) very long offset calculated: %d\n", len, offset);
-						}
-						else // If second bit is 0 (1 0 = 5-bit offset)
-						{
-							/* 5 bits offset */
-                            if (bVerbose) printf("C: delzss: Match (len=%d) 5-bit offset...\n", len);
-							for (i = 0;i < 5;i++)
-							{
-                                if (index_src >= old_index_src) {
-                                    if (bVerbose) printf("C: ERROR: delzss: Compressed input too short for 5-bit offset bit %d/5.\n", i);
-                                    return -1;
-                                }
-								offset <<= 1;
-								offset |= read_bit();
-							}
-                            if (bVerbose) printf("C: delzss: Match (len=%d) 5-bit offset calculated: %d\n", len, offset);
-						}
-					}
-				}
-				// Perform the match copy
-                if (bVerbose) printf("C: delzss: Copying match: src_start_dest_index=%d, len=%d, offset=%d\n", index_dest - offset - 1, len, offset);
-
-                int source_start_index = index_dest - offset - 1;
-                if (source_start_index < 0 || source_start_index + len > index_dest) { // Basic bounds check for source
-                    if (bVerbose) printf("C: CRITICAL ERROR: delzss: Match copy source bounds invalid! src_idx=%d, len=%d, current_dest=%d. Aborting.\n", source_start_index, len, index_dest);
-                    emscripten_console_log("C-CRITICAL: Decomp match source OOB!");
-                    EM_ASM({ debugger; });
-                    abort();
-                }
-                if (index_dest + len > MAX) { // Basic bounds check for destination
-                    if (bVerbose) printf("C: CRITICAL ERROR: delzss: Match copy dest bounds invalid! dest_idx=%d, len=%d, MAX=%d. Aborting.\n", index_dest, len, MAX);
-                    emscripten_console_log("C-CRITICAL: Decomp match dest OOB!");
-                    EM_ASM({ debugger; });
-                    abort();
-                }
-
-				for (i = 0; i < len; i++)
-				{
-					// Ensure no read out of bounds from data_dest for source
-					// This is `data_dest[current_write_pos] = data_dest[current_write_pos - offset - 1]`
-					data_dest[index_dest + i] = data_dest[source_start_index + i];
-				}
-				index_dest += len;
-			}
-		}
-	}
-    if (bVerbose) printf("C: delzss END. Final index_dest: %d\n", index_dest);
-	return index_dest; // Return decompressed size
-}
-
-/*
- * - WRAPPER FUNCTIONS FOR JAVASCRIPT -
- * These functions will be called from JavaScript via Emscripten.
- * They handle copying data between JavaScript's memory (passed pointers)
- * and C's internal global buffers (`data_src`, `data_dest`).
- */
-// Function to set global compression options from JS
-EMSCRIPTEN_KEEPALIVE
-void set_dan3_options(int max_bits, int rle_enabled, int fast_mode) {
-    if (bVerbose) printf("C: set_dan3_options called. max_bits=%d, rle=%d, fast=%d\n", max_bits, rle_enabled, fast_mode);
-    if (max_bits > BIT_OFFSET_MAX) max_bits = BIT_OFFSET_MAX;
-    if (max_bits < BIT_OFFSET_MIN) max_bits = BIT_OFFSET_MIN;
-    BIT_OFFSET_MAX_ALLOWED = max_bits;
-    BIT_OFFSET_NBR_ALLOWED = BIT_OFFSET_MAX_ALLOWED - BIT_OFFSET_MIN + 1;
-
-    bRLE = rle_enabled; // C's TRUE/FALSE are -1/0. JS boolean is 1/0.
-    bFAST = fast_mode;  // C's TRUE/FALSE are -1/0.
-    if (bVerbose) printf("C: set_dan3_options: BIT_OFFSET_MAX_ALLOWED=%d, BIT_OFFSET_NBR_ALLOWED=%d, bRLE=%d, bFAST=%d\n",
-                           BIT_OFFSET_MAX_ALLOWED, BIT_OFFSET_NBR_ALLOWED, bRLE, bFAST);
-}
-
-// Wrapper for encode function
-// Takes input data, its length, and an output buffer pointer.
-// Returns the compressed length.
-EMSCRIPTEN_KEEPALIVE
-int dan3_encode(uint8_t* input_buf, int input_len, uint8_t* output_buf) {
-    if (bVerbose) printf("C: dan3_encode START. input_len=%d, input_buf=%p, output_buf=%p\n", input_len, (void*)input_buf, (void*)output_buf);
-    // Ensure input_len doesn't exceed MAX
-    if (input_len > MAX) {
-        if (bVerbose) printf("C: ERROR: dan3_encode input_len %d exceeds MAX %d\n", input_len, MAX);
-        return -1; // Indicate error
-    }
-
-    // Copy input data from JS memory to C's global data_src
-    memcpy(data_src, input_buf, input_len);
-    index_src = input_len; // Set C's global index_src
-
-    // Reset bit counters before compression begins
-    bit_mask = 0;
-    bit_index = 0;
-
-    // Call the original compression logic
-    int compressed_len = lzss_slow();
-
-    // Copy compressed data from C's global data_dest to JS-provided output_buf
-    // Only copy if compression was successful (len >= 0)
-    if (compressed_len >= 0) {
-        // Defensive check: Ensure compressed_len doesn't exceed data_dest's capacity
-        // This generally implies index_dest should not exceed MAX within write_lz
-        if (compressed_len > MAX) {
-            if (bVerbose) printf("C: ERROR: dan3_encode: compressed_len (%d) exceeds MAX (%d) after lzss_slow!\n", compressed_len, MAX);
-            return -1; // Indicates internal overflow
-        }
-        memcpy(output_buf, data_dest, compressed_len);
-        if (bVerbose) printf("C: dan3_encode END. Returned compressed_len: %d\n", compressed_len);
-    } else {
-        if (bVerbose) printf("C: dan3_encode END. lzss_slow returned error: %d\n", compressed_len);
-    }
-
-    return compressed_len;
-}
-
-// Wrapper for decode function
-// Takes compressed input data, its length, and an output buffer pointer.
-// Returns the decompressed length.
-EMSCRIPTEN_KEEPALIVE
-int dan3_decode(uint8_t* input_buf, int input_len, uint8_t* output_buf) {
-    if (bVerbose) printf("C: dan3_decode START. input_len=%d, input_buf=%p, output_buf=%p\n", input_len, (void*)input_buf, (void*)output_buf);
-    // Ensure input_len doesn't exceed MAX
-    if (input_len > MAX) {
-        if (bVerbose) printf("C: ERROR: dan3_decode input_len %d exceeds MAX %d\n", input_len, MAX);
-        return -1; // Indicate error
-    }
-
-    // Copy compressed input data from JS memory to C's global data_src
-    memcpy(data_src, input_buf, input_len);
-    index_src = input_len; // Set C's global index_src (for reading compressed data)
-
-    // Reset bit counters before decompression begins
-    bit_mask = 0;
-    bit_index = 0;
-
-    // Call the original decompression logic
-    int decompressed_len = delzss();
-
-    // Copy decompressed data from C's global data_dest to JS-provided output_buf
-    // Only copy if decompression was successful (len >= 0)
-    if (decompressed_len >= 0) {
-        // Defensive check: Ensure decompressed_len doesn't exceed data_dest's capacity (or original MAX if it's assumed)
-        // This implies index_dest should not exceed MAX within delzss
-        if (decompressed_len > MAX) {
-            if (bVerbose) printf("C: ERROR: dan3_decode: decompressed_len (%d) exceeds MAX (%d) after delzss!\n", decompressed_len, MAX);
-            return -1; // Indicates internal overflow
-        }
-        memcpy(output_buf, data_dest, decompressed_len);
-        if (bVerbose) printf("C: dan3_decode END. Returned decompressed_len: %d\n", decompressed_len);
-    } else {
-        if (bVerbose) printf("C: dan3_decode END. delzss returned error: %d\n", decompressed_len);
-    }
-
-    return decompressed_len;
-}
-
-// Keeping original functions keepalive for direct internal testing if needed,
-// but the wrappers are preferred for JS interaction.
-// Note: These now call the new wrapper functions implicitly assuming data_src/dest are populated.
-EMSCRIPTEN_KEEPALIVE int encode() { return dan3_encode(data_src, index_src, data_dest); }
-EMSCRIPTEN_KEEPALIVE int decode() { return dan3_decode(data_src, index_src, data_dest); }
-
-// Keep set_max_bits_allowed keepalive if it's explicitly called from JS
-// (Though set_dan3_options replaces its functionality combined with flags)
-// It's fine to keep it for now.
-EMSCRIPTEN_KEEPALIVE void set_max_bits_allowed(int bits)
-{
-    if (bVerbose) printf("C: set_max_bits_allowed called (legacy). bits=%d\n", bits);
-	if (bits > BIT_OFFSET_MAX) bits = BIT_OFFSET_MAX;
-	if (bits < BIT_OFFSET_MIN) bits = BIT_OFFSET_MIN;
-	BIT_OFFSET_MAX_ALLOWED = bits;
-	BIT_OFFSET_NBR_ALLOWED = BIT_OFFSET_MAX_ALLOWED - BIT_OFFSET_MIN + 1;
-}
-
-// --- Debugging getter functions ---
-EMSCRIPTEN_KEEPALIVE
-int get_optimal_bits(int index, int subset) {
-    if (index >= 0 && index < MAX && subset >= 0 && subset < BIT_OFFSET_NBR) {
-        return optimals[index].bits[subset];
-    }
-    // Return a distinguishable error value
-    return 0x7FFFFFFF; // Max signed 32-bit int, matches "Infinity" representation
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_optimal_offset(int index, int subset) {
-    if (index >= 0 && index < MAX && subset >= 0 && subset < BIT_OFFSET_NBR) {
-        return optimals[index].offset[subset];
-    }
-    return -1;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_optimal_len(int index, int subset) {
-    if (index >= 0 && index < MAX && subset >= 0 && subset < BIT_OFFSET_NBR) {
-        return optimals[index].len[subset];
-    }
-    return -1;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_bit_mask() {
-    return (int)bit_mask;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_bit_index() {
-    return bit_index;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_bFAST() {
-    return bFAST;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_bRLE() {
-    return bRLE;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_BIT_OFFSET3() {
-    return BIT_OFFSET3;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_MAX_OFFSET3() {
-    return MAX_OFFSET3;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_BIT_OFFSET_MAX_ALLOWED() {
-    return BIT_OFFSET_MAX_ALLOWED;
-}
-
-EMSCRIPTEN_KEEPALIVE
-int get_BIT_OFFSET_NBR_ALLOWED() {
-    return BIT_OFFSET_NBR_ALLOWED;
-}
-
-/*
- * - REMOVED MAIN FUNCTION AND FILE I/O HELPERS -
- * (These are handled by the JavaScript environment)
- */
-// int main(int argc, char *argv[]) { // ... }
-// void help(void) { // ... }
-// int file_exits(char *filename) { // ... }
-// long file_size(FILE *file) { // ... }
-// int yesno () { // ... }
-// void ask_overwrite(char *filename) { // ... }
-// char *newfilepathLZ(char* filepath) { // ... }
-// char *newfilepathRAW(char* filepath) { // ... }
\ No newline at end of file
+/* DAN3 Encoder - Decoder (Emscripten Friendly with Debug Prints)
+ * ------------
+ * HISTORY
+ * 20170220 - BETA
+ * 20171123 - BETA (clean up)
+ * 20171218 - CHANGE RLE ENCODING AND OPTION
+ * 20180103 - ADD MAXIMUM BITS ALLOWED TO ENCODE OFFSET
+ * 20180113 - ADD DECOMPRESSION ROUTINE
+ * 20180118 - SPEED OPTIMIZATION IN COMPRESSION ROUTINE
+ * 20180123 - FIX SPEED OPTIMIZATION
+ * 20180126 - FIX RLE COMPRESSION
+ * 20180126 - FIX READ GOLOMB VALUES
+ * 20261018 - NATIVE BUILD WITH MEMORY-MAPPED FILE I/O
+ * 20261018 - STREAMING DECOMPRESSION
+ * 20261018 - PARALLEL OPTIMAL PARSE
+ * 20261018 - SUBSET PRUNING BEFORE THE OPTIMAL PARSE
+ * 20261018 - TOKEN LIST BETWEEN THE PARSE AND THE WRITER, ANALYSIS GETTERS
+ * 20261018 - RESUMABLE ENCODER (dan3_encode_begin/step)
+ * 20261018 - LOW MEMORY MODE (ROLLING COST TABLE)
+ * 20261018 - BATCH ENCODE, SETUP PROPORTIONAL TO THE INPUT SIZE
+ * 20261018 - Z80 DECODE TIME ESTIMATE
+ * 20261018 - GRAPHICS TRANSFORMS (STRIDE, PLANES, DELTA)
+ * 20261018 - SIZE PREDICTION AND WORST-CASE BOUND (dan3_predict_size/bound)
+ * 20261018 - AUTO-TUNE OVER SHARED MATCH CHAINS
+ * 20261018 - LINEAR TIME ON RUNS AND PERIODIC DATA
+ * 20261018 - NODE.JS ADDON (node/), ASYNC ENCODE/DECODE OFF THE EVENT LOOP
+ * 20261018 - TIME BUDGET ENCODE (deadline_ms), EFFORT PER REGION
+ * 20261018 - BRANCH AND BOUND IN THE OPTIMAL PARSE
+ * 20261018 - WORKING MEMORY ALLOCATED ON FIRST USE, SIZED TO THE INPUT
+ * 20261018 - ENCODER SERVER (dan3 --serve), POOL OF WORKER PROCESSES
+ * 20261018 - SIMD128 BUILD (VECTOR COST UPDATE AND DECODER COPIES)
+ * 20261018 - MEMORY BUDGET (max_memory), CHUNKED BACK-POINTERS
+ * 20261018 - OPTIONAL CRC-32 TRAILER, CHECKED WHILE DECODING
+ * 20261018 - SPLIT STREAMS VARIANT (CONTROL BITS, GAMMAS, BYTES APART)
+ * 20261018 - THREAD-LOCAL CODEC STATE, CONCURRENT ENCODE/DECODE IN ONE PROCESS
+ *
+ * Emscripten-specific modifications by Google Gemini (2025-07-10)
+ * - Added emscripten.h and EMSCRIPTEN_KEEPALIVE.
+ * - Removed file I/O (main, fopen, fclose, printf, scanf, etc.).
+ * - Introduced wrapper functions (dan3_encode, dan3_decode) for JS interaction.
+ * - Added extensive debug printf statements for WASM execution analysis.
+ *
+ * Native build
+ * - Builds without Emscripten: cc -O2 -pthread -o dan3 dan3final.c
+ * - Release variant (no traces, no per-byte checks): add -DDAN3_RELEASE,
+ *   with cc or emcc. Compare both with: dan3 -b file(s)
+ * - The codec works on ptr_src/ptr_dest instead of the static arrays, so the
+ *   wrappers no longer copy and the native tool runs on memory-mapped files.
+ * - dan3 -t<threads> splits the optimal parse over several cores.
+ * - The codec globals are thread-local (DAN3_TLS): each thread that calls
+ *   dan3_encode/dan3_decode has its own options, buffers and tables, so a
+ *   library build can run one job per thread with no lock. Parse threads
+ *   borrow their caller's buffers (see STATE OF A PARSE THREAD).
+ * - dan3 -u file(s) feeds truncated and bit-flipped streams to the decoders;
+ *   build it with -DDAN3_RELEASE -fsanitize=address (see CORRUPT INPUT TEST).
+ *
+ * WASM build (in node/, where index.js, the package and index.html load it)
+ * - emcc -O2 -DDAN3_RELEASE -sMODULARIZE -sEXPORT_NAME=createDan3Module
+ *   -sINITIAL_MEMORY=2MB -sALLOW_MEMORY_GROWTH
+ *   -sEXPORTED_FUNCTIONS=_malloc,_free -sEXPORTED_RUNTIME_METHODS=HEAPU8,HEAP32
+ *   -o dan3final.js ../dan3final.c
+ *   (npm run build:wasm). Rebuild it with every change to this file: the
+ *   checked-in module must carry the current C_ABI.
+ * - Nothing is sized to MAX statically: the module starts at 2 MB and grows
+ *   to what the inputs need (see WORKING MEMORY). node/bench-startup.js
+ *   times a cold start to a first encode (npm run bench:startup).
+ * - SIMD variant: same command with -msimd128 -o dan3final_simd.js
+ *   (npm run build:wasm-simd), checked in next to dan3final.js and
+ *   rebuilt with it. It updates the costs of four subsets per instruction and
+ *   copies matches 16 bytes at a time. index.html and node/index.js load it
+ *   when the runtime validates a v128 module and get_simd() confirms it,
+ *   dan3final.js otherwise. Natively, -DDAN3_SIMD builds the same vector
+ *   code (SSE2/NEON) to compare the outputs: its .dan3 files must match.
+ */
+#include <stdio.h>    /* For printf (debugging) */
+#include <stdlib.h>   /* malloc, free */
+#include <string.h>   /* memcpy, memset */
+#include <ctype.h>    /* tolower */
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h> /* For EMSCRIPTEN_KEEPALIVE */
+#include <emscripten/em_asm.h> // For EM_ASM macros
+#include <emscripten/console.h> // For emscripten_console_log
+#define DAN3_TLS
+#else
+#include <fcntl.h>    /* open */
+#include <unistd.h>   /* close, ftruncate */
+#include <sys/mman.h> /* mmap, munmap */
+#include <sys/stat.h> /* fstat */
+#include <time.h>     /* clock_gettime */
+#include <pthread.h>  /* parallel optimal parse */
+#include <poll.h>     /* --serve */
+#include <signal.h>   /* --serve */
+#include <sys/socket.h> /* --serve */
+#include <sys/un.h>   /* --serve */
+#include <sys/wait.h> /* --serve */
+#define DAN3_TLS _Thread_local /* codec state, one copy per thread */
+#define EMSCRIPTEN_KEEPALIVE
+#define EM_ASM(...) ((void)0)
+#define emscripten_console_log(msg) fprintf(stderr, "%s\n", (msg))
+#endif
+#include <stdint.h>   /* For uint8_t */
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h> /* __crc32d, __crc32b */
+#endif
+#if defined(__wasm_simd128__) || defined(DAN3_SIMD)
+#define DAN3_VECTOR	1 /* 128-bit vectors: emcc -msimd128, or -DDAN3_SIMD natively */
+typedef int32_t v4i32 __attribute__((vector_size(16)));
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+#else
+#define DAN3_VECTOR	0
+#endif
+
+/*
+ * - AUTHOR'S NAME -
+ */
+#define AUTHOR "Daniel Bienvenu aka NewColeco"
+/*
+ * - PROGRAM TITLE -
+ */
+#define PRGTITLE "DAN3 Compression Tool"
+/*
+ * - VERSION NUMBER -
+ */
+#define VERSION "BETA-20180126"
+/*
+ * - YEAR -
+ */
+#define YEAR "2018"
+/*
+ * - FILE EXTENSION -
+ */
+#define EXTENSION ".dan3"
+#define EXTENSIONBIN ".bin"
+/*
+ * - BOOLEAN VALUES -
+ */
+#define TRUE -1
+#define FALSE 0
+/*
+ * - MAX INPUT FILE SIZE -
+ */
+#define MAX 1024*1024 // 256KB
+/*
+ * - COMPRESSION CONSTANTS -
+ */
+#define BIT_GOLOMG_MAX	7
+#define MAX_GAMMA		(1<<(BIT_GOLOMG_MAX+1)) - 2
+#define BIT_OFFSET00	0
+#define BIT_OFFSET0		1
+#define BIT_OFFSET1		5
+#define BIT_OFFSET2		8
+#define BIT_OFFSET_MIN	9
+#define BIT_OFFSET_MAX	16
+#define BIT_OFFSET_NBR	BIT_OFFSET_MAX - BIT_OFFSET_MIN + 1
+
+// Mark constants with EMSCRIPTEN_KEEPALIVE if JS needs their *exact* values
+EMSCRIPTEN_KEEPALIVE const int C_BIT_OFFSET_MIN = BIT_OFFSET_MIN;
+EMSCRIPTEN_KEEPALIVE const int C_BIT_OFFSET_MAX = BIT_OFFSET_MAX;
+EMSCRIPTEN_KEEPALIVE const int C_BIT_OFFSET_NBR = BIT_OFFSET_NBR;
+EMSCRIPTEN_KEEPALIVE const int C_MAX = MAX;
+// Bumped when the exports or the stream format change: node/index.js and
+// index.html refuse a dan3final.js/.wasm without this value (built from an
+// older dan3final.c) instead of running it.
+#define DAN3_ABI	3
+EMSCRIPTEN_KEEPALIVE const int C_ABI = DAN3_ABI;
+
+#define MAX_OFFSET00	(1<<BIT_OFFSET00)
+#define MAX_OFFSET0		(1<<BIT_OFFSET0) + MAX_OFFSET00
+#define MAX_OFFSET1		(1<<BIT_OFFSET1)
+#define MAX_OFFSET2		(1<<BIT_OFFSET2) + MAX_OFFSET1
+#define MAX_OFFSET		(1<<BIT_OFFSET_MAX) + MAX_OFFSET2
+#define RAW_MIN	1
+#define RAW_RANGE (1<<8)
+#define RAW_MAX RAW_MIN + RAW_RANGE - 1
+
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int BIT_OFFSET3;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int MAX_OFFSET3;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int BIT_OFFSET_MAX_ALLOWED;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int BIT_OFFSET_NBR_ALLOWED;
+
+/*
+ * - BUILD POLICY -
+ * The default (checked) build validates every byte access and honours
+ * bVerbose. Building with -DDAN3_RELEASE compiles the traces and the per-byte
+ * defensive checks out: buffer capacities are validated once up front (the
+ * exact compressed size is known before write_lz) and the decoder only keeps
+ * its per-token checks. -DDAN3_LIBRARY leaves the command line tool out, to
+ * link the codec into another program (node/ builds the Node.js addon so).
+ */
+#ifdef DAN3_RELEASE
+#define DAN3_CHECKED	0
+#else
+#define DAN3_CHECKED	1
+#endif
+#define VERBOSE	(DAN3_CHECKED && bVerbose)
+
+/*
+ * - OPTIONS FLAGS -
+ */
+// These are now set by JS wrapper functions
+EMSCRIPTEN_KEEPALIVE int bVerbose = FALSE;
+EMSCRIPTEN_KEEPALIVE int bYes = FALSE;     // Not used in WASM context
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int bFAST = FALSE; // Thread-local: auto-tune parses variants side by side
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int bRLE = TRUE;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int bPRUNE = TRUE; // Estimate the offset sizes and skip the hopeless ones
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int bBOUND = TRUE; // Skip the tokens that cannot lower a cost (see BRANCH AND BOUND)
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int bLOWMEM = FALSE; // Rolling cost table and packed back-pointers
+DAN3_TLS int bPREDICT = FALSE; // Stop after the optimal parse and return the size (dan3_predict_size)
+EMSCRIPTEN_KEEPALIVE int nThreads = 1;  // Native only: threads for the optimal parse
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int deadline_ms = 0; // Time budget of one encode, 0 = none (see TIME BUDGET)
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int max_memory = 0; // Working memory of one encode in bytes, 0 = no limit (see MEMORY BUDGET)
+DAN3_TLS int chain_depth = 0; // Chain entries tried per position, 0 = all (lowered to meet the time budget)
+
+/*
+ * - WORKING MEMORY -
+ * Buffers holding one entry per input position (match_prev, optimals_table,
+ * data_src/data_dest) are allocated on first use and grown to the largest
+ * input seen; the tokens to the longest path seen (see TOKEN BUFFER). A 4 KB
+ * input takes a few hundred KB instead of the 100+ MB the static arrays asked
+ * before anything ran, and the WASM module instantiates with a small memory.
+ * Contents are not kept when growing, except the tokens'.
+ */
+// Makes *buffer hold count items of size bytes. FALSE when out of memory.
+int grow_buffer(void **buffer, int *capacity, int count, size_t size)
+{
+	if (count <= *capacity) return TRUE;
+	free(*buffer);
+	*buffer = malloc(size * count);
+	*capacity = (*buffer == NULL ? 0 : count);
+	if (VERBOSE) printf("C: grow_buffer: %d x %d bytes%s\n", count, (int) size, *buffer == NULL ? " FAILED" : "");
+	return (*buffer != NULL);
+}
+
+/*
+ * - IN-MEMORY BUFFERS -
+ * JavaScript fills data_src and reads data_dest through HEAPU8. They are
+ * allocated by dan3_reserve(input_len): get_data_src/get_data_dest return
+ * their addresses.
+ */
+DAN3_TLS unsigned char *data_src = NULL;
+DAN3_TLS int data_src_capacity = 0;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int index_src;
+DAN3_TLS unsigned char *data_dest = NULL;
+DAN3_TLS int data_dest_capacity = 0;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int index_dest;
+/*
+ * - WORKING BUFFERS -
+ * The codec reads through ptr_src and writes through ptr_dest. They point at
+ * the caller's buffers (JS heap buffers, memory-mapped files, data_src and
+ * data_dest) so no copy is needed. size_src and size_dest are the capacities
+ * used by the bounds checks.
+ */
+DAN3_TLS unsigned char *ptr_src = NULL;
+DAN3_TLS int size_src = 0;
+DAN3_TLS unsigned char *ptr_dest = NULL;
+DAN3_TLS int size_dest = 0;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS unsigned char bit_mask;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int bit_index;
+
+/*
+ * - MATCHES -
+ * Hash chains on the 2-byte prefix ending at each position: match_head[key]
+ * is the latest position inserted with that prefix and match_prev[index] the
+ * one inserted before index. Being position-indexed, the chains need no
+ * allocation per match and, once built, are shared read-only by the threads
+ * of the parallel parse.
+ */
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int match_head[65536];
+DAN3_TLS int *match_prev = NULL;
+DAN3_TLS int match_prev_capacity = 0;
+
+struct t_optimal
+{
+	int bits[BIT_OFFSET_NBR]; /* COST */
+	int offset[BIT_OFFSET_NBR];
+	int len[BIT_OFFSET_NBR];
+	int potential; /* SEE BRANCH AND BOUND */
+};
+// Cost table of the whole input (see WORKING MEMORY), read by the getters
+DAN3_TLS struct t_optimal *optimals_table = NULL;
+DAN3_TLS int optimals_table_capacity = 0;
+// Table used by the DP: optimals_table, the segment table of a parse thread
+// or, in low memory mode, optimals_ring indexed modulo its size
+DAN3_TLS struct t_optimal *optimals = NULL;
+DAN3_TLS int optimals_mask = -1;
+#define OPTIMAL(index) optimals[(index) & optimals_mask]
+
+/*
+ * - LOW MEMORY MODE -
+ * Tokens reach back at most RAW_MAX positions, so with bLOWMEM the DP keeps
+ * its costs in a ring of OPTIMALS_RING entries. Once a position is scanned,
+ * its (len, offset) for the live subsets is packed into back_pointers: that
+ * is all the backtrack needs. 4 bytes per position and live subset instead
+ * of the 100 bytes per position of optimals_table.
+ */
+#define OPTIMALS_RING	512
+DAN3_TLS struct t_optimal optimals_ring[OPTIMALS_RING];
+DAN3_TLS uint32_t *back_pointers = NULL; /* len | offset << 9, subset_low..subset_high */
+DAN3_TLS int back_pointers_count = 0; /* entries allocated */
+DAN3_TLS int back_pointer_first = 0; /* position of back_pointers[0] (see MEMORY BUDGET) */
+// The ring before a chunk is scanned, to scan it again during the backtrack
+struct t_checkpoint
+{
+	struct t_optimal ring[OPTIMALS_RING];
+	int prev_match_index;
+};
+DAN3_TLS struct t_checkpoint *checkpoints = NULL;
+DAN3_TLS int checkpoint_count = 0;
+// Layout chosen by plan_memory (see MEMORY BUDGET)
+#define MEMORY_FULL		0 /* cost table of the whole input */
+#define MEMORY_RING		1 /* cost ring, back-pointers of every position */
+#define MEMORY_CHUNKED	2 /* cost ring, back-pointers of one chunk */
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int memory_layout = MEMORY_FULL;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int memory_threads = 1; /* parse threads (segments) */
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int memory_chunk = 0; /* positions per chunk */
+DAN3_TLS long memory_peak = 0; /* bytes, last encode */
+DAN3_TLS long memory_needed = 0; /* bytes, last encode refused by max_memory */
+void note_memory(long extra);
+// Subsets carried through the DP (see prune_subsets)
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int subset_low = 0;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int subset_high = BIT_OFFSET_NBR - 1;
+
+/*
+ * - INSERT A MATCH IN TABLE -
+ */
+void insert_match(int index)
+{
+	int match_index = ((int) ptr_src[index-1]) << 8 | ((int) ptr_src[index] & 255);
+	match_prev[index] = match_head[match_index];
+	match_head[match_index] = index;
+}
+
+/*
+ * - FORGET THE BUCKETS OF THIS INPUT -
+ * Chains are only entered through insert_match, which reads the head of the
+ * bucket of the position inserted. Emptying the buckets the input uses is
+ * enough: stale heads elsewhere are never read. O(input) instead of 65536.
+ */
+void clear_matches(void)
+{
+	int i;
+	for (i = 1; i < index_src; i++)
+	{
+		match_head[((int) ptr_src[i-1]) << 8 | ((int) ptr_src[i] & 255)] = -1;
+	}
+}
+
+/*
+ * - FREE MATCH(ES) FROM TABLE -
+ */
+// This function will be called from lzss_slow.
+EMSCRIPTEN_KEEPALIVE void reset_matches(void)
+{
+    if (VERBOSE) printf("C: reset_matches: Clearing all 65536 match lists\n");
+	int i;
+	for (i = 0;i < 65536;i++)
+	{
+		match_head[i] = -1;
+	}
+}
+
+/*
+ * - LOW BYTE VALUE - (Utility, might not be used directly in WASM context)
+ */
+int mask_byte(int value)
+{
+	return (value & 255);
+}
+
+/*
+ * - ERROR MESSAGE (EOF) - (No longer used with direct memory access)
+ */
+// void error(void) { // printf("Output error\n"); exit(1); }
+
+/*
+ * - READ BYTE - (Works with ptr_src in memory)
+ */
+unsigned char read_byte()
+{
+    if (DAN3_CHECKED && (index_src < 0 || index_src >= size_src)) { // This is an out-of-bounds read check
+        if (VERBOSE) printf("C: CRITICAL ERROR: read_byte out of bounds! index_src=%d, size_src=%d. Aborting.\n", index_src, size_src);
+        emscripten_console_log("C-CRITICAL: Read_byte out of bounds!");
+        EM_ASM({ debugger; });
+        abort();
+    }
+	return ptr_src[index_src++];
+}
+
+/*
+ * - READ BIT - (Works with ptr_src in memory)
+ */
+unsigned char read_bit()
+{
+	unsigned char bit;
+    if (bit_mask == 0)
+	{
+		bit_mask  = (unsigned char) 128;
+		bit_index = index_src;
+        if (DAN3_CHECKED && (bit_index < 0 || bit_index >= size_src)) { // Out of bounds for ptr_src access
+            if (VERBOSE) printf("C: CRITICAL ERROR: read_bit (new byte) out of bounds! bit_index=%d, size_src=%d. Aborting.\n", bit_index, size_src);
+            emscripten_console_log("C-CRITICAL: Read_bit (new byte) out of bounds!");
+            EM_ASM({ debugger; });
+            abort();
+        }
+		index_src++;
+	}
+    // Check bit_index again before actual access if bit_mask was not 0
+    if (DAN3_CHECKED && (bit_index < 0 || bit_index >= size_src)) { // Defensive check in case bit_index was somehow bad
+        if (VERBOSE) printf("C: CRITICAL ERROR: read_bit (existing byte) out of bounds! bit_index=%d, size_src=%d. Aborting.\n", bit_index, size_src);
+        emscripten_console_log("C-CRITICAL: Read_bit (existing byte) out of bounds!");
+        EM_ASM({ debugger; });
+        abort();
+    }
+	bit = (ptr_src[bit_index] & bit_mask);
+	bit_mask >>= 1 ;
+	return (bit != 0 ? 1 : 0 );
+}
+
+/*
+ * - READ GOLOMB GAMMA - (-2 when the input, end bytes, runs out inside it)
+ */
+int read_golomb_gamma(int end)
+{
+    if (VERBOSE) printf("C: read_golomb_gamma START (index_src: %d, bit_index: %d)\n", index_src, bit_index);
+	int value = 0;
+	int i, j = 0;
+	while (j < BIT_GOLOMG_MAX)
+	{
+		if (bit_mask == 0 && index_src >= end) return -2;
+		if (read_bit() != 0) break;
+		j++;
+	}
+	if (j < BIT_GOLOMG_MAX)
+	{
+		value = 1;
+		for (i = 0; i <= j; i++)
+		{
+			if (bit_mask == 0 && index_src >= end) return -2;
+			value <<= 1;
+			value |= read_bit();
+		}
+	}
+	value--;
+    if (VERBOSE) printf("C: read_golomb_gamma END, value: %d\n", value);
+	return value;
+}
+
+/*
+ * - WRITE DATA - (Works with ptr_dest in memory)
+ */
+void write_byte(unsigned char value)
+{
+    if (DAN3_CHECKED && (index_dest < 0 || index_dest >= size_dest)) { // Out of bounds write check
+        if (VERBOSE) printf("C: CRITICAL ERROR: write_byte out of bounds! index_dest=%d, size_dest=%d. Aborting.\n", index_dest, size_dest);
+        emscripten_console_log("C-CRITICAL: Write_byte out of bounds!");
+        EM_ASM({ debugger; });
+        abort();
+    }
+	ptr_dest[index_dest++] = value;
+}
+
+/*
+ * - BLOCK COPY -
+ * Forward copy for the decoder: a match from earlier output, or an RLE run
+ * from the input (which can sit just ahead in the same buffer when decoding
+ * in place). Overlapping matches closer than 16 bytes repeat their pattern
+ * and go byte by byte.
+ */
+void copy_forward(uint8_t *dest, const uint8_t *src, int len)
+{
+	int i = 0;
+#if DAN3_VECTOR
+	v16u8 block;
+
+	if ((uintptr_t) dest <= (uintptr_t) src || (uintptr_t) dest - (uintptr_t) src >= sizeof(block))
+	{
+		for (; i + (int) sizeof(block) <= len; i += sizeof(block))
+		{
+			memcpy(&block, src + i, sizeof(block));
+			memcpy(dest + i, &block, sizeof(block));
+		}
+	}
+#endif
+	for (; i < len; i++) dest[i] = src[i];
+}
+
+/*
+ * - CHECKSUM TRAILER -
+ * With bCRC the stream starts with 0xFF, 0x80|STREAM_CRC32 (the header of
+ * the graphics transforms, see there) and ends with the CRC-32 of the
+ * decoded data after the end marker, 4 bytes little-endian. Same CRC as zip
+ * and png (reflected 0xEDB88320). write_lz sums the input and delzss its
+ * output in CRC_BLOCK pieces as they go, while the bytes are still in cache:
+ * no separate pass over the data. Slicing by 8 (tables built on first use),
+ * or the ARMv8 CRC32 instructions when the compiler targets them.
+ */
+#define STREAM_CRC32	8 /* header flag: CRC-32 trailer */
+#define CRC_HEADER		2
+#define CRC_TRAILER		4
+#define CRC_BLOCK		4096
+
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int bCRC = FALSE;
+DAN3_TLS int crc_check = FALSE; /* the stream being decoded has a trailer */
+uint32_t crc_table[8][256]; /* shared by every thread, filled once */
+
+void crc32_init()
+{
+	uint32_t crc;
+	int i, k;
+	if (crc_table[0][1] != 0) return;
+	for (i = 0; i < 256; i++)
+	{
+		crc = i;
+		for (k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+		crc_table[0][i] = crc;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		for (k = 1; k < 8; k++) crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 255];
+	}
+}
+
+// CRC-32 of data appended to a previous result (0 to start)
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, int len)
+{
+	crc = ~crc;
+#if defined(__ARM_FEATURE_CRC32)
+	uint64_t word;
+	for (; len >= 8; len -= 8, data += 8)
+	{
+		memcpy(&word, data, 8);
+		crc = __crc32d(crc, word);
+	}
+	for (; len > 0; len--) crc = __crc32b(crc, *data++);
+#else
+	uint32_t one, two;
+#ifdef __EMSCRIPTEN__
+	crc32_init();
+#else
+	static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+	pthread_once(&crc_once, crc32_init);
+#endif
+	for (; len >= 8; len -= 8, data += 8)
+	{
+		one = crc ^ (data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24);
+		two = data[4] | data[5] << 8 | data[6] << 16 | (uint32_t) data[7] << 24;
+		crc = crc_table[7][one & 255] ^ crc_table[6][(one >> 8) & 255] ^ crc_table[5][(one >> 16) & 255] ^ crc_table[4][one >> 24]
+			^ crc_table[3][two & 255] ^ crc_table[2][(two >> 8) & 255] ^ crc_table[1][(two >> 16) & 255] ^ crc_table[0][two >> 24];
+	}
+	for (; len > 0; len--) crc = crc_table[0][(crc ^ *data++) & 255] ^ (crc >> 8);
+#endif
+	return ~crc;
+}
+
+void write_bit(int value)
+{
+	if (bit_mask == 0)
+	{
+		bit_mask  = (unsigned char) 128;
+		bit_index = index_dest;
+        if (DAN3_CHECKED && (bit_index < 0 || bit_index >= size_dest)) { // Out of bounds for ptr_dest access
+            if (VERBOSE) printf("C: CRITICAL ERROR: write_bit (new byte) out of bounds! bit_index=%d, size_dest=%d. Aborting.\n", bit_index, size_dest);
+            emscripten_console_log("C-CRITICAL: Write_bit (new byte) out of bounds!");
+            EM_ASM({ debugger; });
+            abort();
+        }
+		write_byte((unsigned char) 0); // This internal call to write_byte will check bounds too
+	}
+    // Check bit_index again before actual access if bit_mask was not 0
+    if (DAN3_CHECKED && (bit_index < 0 || bit_index >= size_dest)) { // Defensive check
+        if (VERBOSE) printf("C: CRITICAL ERROR: write_bit (existing byte) out of bounds! bit_index=%d, size_dest=%d. Aborting.\n", bit_index, size_dest);
+        emscripten_console_log("C-CRITICAL: Write_bit (existing byte) out of bounds!");
+        EM_ASM({ debugger; });
+        abort();
+    }
+	if (value) ptr_dest[bit_index] |= bit_mask;
+	bit_mask >>= 1 ;
+}
+
+void write_bits(int value, int size)
+{
+    if (VERBOSE) printf("C: write_bits: value=0x%X, size=%d\n", value, size);
+	int i;
+	int mask = 1;
+	for (i = 0 ; i < size ; i++)
+	{
+		mask <<= 1;
+	}
+	while (mask > 1)
+	{
+		mask >>= 1;
+		write_bit (value & mask);
+	}
+}
+
+void write_golomb_gamma(int value)
+{
+    if (VERBOSE) printf("C: write_golomb_gamma: value=%d\n", value);
+	int i;
+	value++;
+	for (i = 4; i <= value; i <<= 1)
+	{
+		write_bit(0);
+	}
+	while ((i >>= 1) > 0)
+	{
+		write_bit(value & i);
+	}
+}
+
+void write_offset(int value, int option)
+{
+    if (VERBOSE) printf("C: write_offset: value=%d, option=%d (BIT_OFFSET3=%d)\n", value, option, BIT_OFFSET3);
+	value--;
+	if (option == 1) // For len=1 (short matches)
+	{
+		if (value >= MAX_OFFSET00)
+		{
+			write_bit(1);
+			value -= MAX_OFFSET00;
+			write_bits(value, BIT_OFFSET0);
+		}
+		else
+		{
+			write_bit(0);
+			write_bits(value, BIT_OFFSET00);
+		}
+	}
+	else // For len > 1 (longer matches)
+	{
+		if (value >= MAX_OFFSET2)
+		{
+			write_bit(1);
+			write_bit(1);
+			value -= MAX_OFFSET2;
+			write_bits(value >> BIT_OFFSET2, BIT_OFFSET3 - BIT_OFFSET2); // This subtraction needs BIT_OFFSET3 >= BIT_OFFSET2
+			write_byte((unsigned char) (value & 255)); /* BIT_OFFSET2 = 8 */
+		}
+		else
+		{
+			if (value >= MAX_OFFSET1)
+			{
+				write_bit(0);
+				value -= MAX_OFFSET1;
+				write_byte((unsigned char) (value & 255)); /* BIT_OFFSET2 = 8 */
+			}
+			else
+			{
+				write_bit(1);
+				write_bit(0);
+				write_bits(value, BIT_OFFSET1);
+			}
+		}
+	}
+}
+
+void write_doublet(int length, int offset)
+{
+    if (VERBOSE) printf("C: write_doublet: len=%d, offset=%d\n", length, offset);
+	write_bit(0);
+	write_golomb_gamma(length);
+	write_offset(offset, length);
+}
+
+void write_end()
+{
+    if (VERBOSE) printf("C: write_end marker\n");
+	write_bit(0);
+	write_bits(0, BIT_GOLOMG_MAX);
+	write_bit(0);
+}
+
+void write_literals_length(int length)
+{
+    if (VERBOSE) printf("C: write_literals_length: len=%d\n", length);
+	write_bit(0);
+	write_bits(0, BIT_GOLOMG_MAX);
+	write_bit(1);
+	length -= RAW_MIN;
+	write_byte((unsigned char) length);
+}
+
+void write_literal(unsigned char c)
+{
+    if (VERBOSE) printf("C: write_literal: char=0x%02X\n", c);
+	write_bit(1);
+	write_byte(c);
+}
+
+// write_destination is removed as file I/O is handled in JS
+// void write_destination() { // ... }
+
+/*
+ * - IN-PLACE DECOMPRESSION MARGIN -
+ * For in-place decompression the compressed data sits at the tail of a buffer
+ * of (decompressed size + inplace_margin) bytes and is decoded over itself.
+ * After each token, the decoder has written `decoded` bytes and still needs
+ * the compressed bytes from the current bit byte (if bits are pending) or
+ * from the read cursor on: the writes must stay below that point.
+ * Split streams (-1) cannot be decoded in place.
+ */
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int inplace_margin;
+DAN3_TLS int inplace_delta; /* Largest (decoded - needed) seen by write_lz */
+
+void update_inplace_delta(int decoded)
+{
+	int needed = (bit_mask != 0 ? bit_index : index_dest);
+	if (decoded - needed > inplace_delta) inplace_delta = decoded - needed;
+}
+
+/*
+ * - TOKENS -
+ * The chosen parse in stream order, the first raw byte included. It is built
+ * by walking the DP path back from the end, serialized by write_lz and read
+ * back by the analysis getters. bits is the exact cost of the token in the
+ * stream; header and end marker aside, they add up to the compressed size.
+ */
+#define TOKEN_LITERAL	0
+#define TOKEN_RLE		1
+#define TOKEN_MATCH		2
+#define OFFSET_CLASS_NONE	0 /* literal or RLE */
+#define OFFSET_CLASS_0		1 /* match of 1 byte */
+#define OFFSET_CLASS_1		2 /* BIT_OFFSET1 bits */
+#define OFFSET_CLASS_2		3 /* BIT_OFFSET2 bits */
+#define OFFSET_CLASS_3		4 /* BIT_OFFSET3 bits */
+
+struct t_token
+{
+	int len;
+	int offset; /* 0 for literals and RLE */
+	int bits;
+};
+DAN3_TLS struct t_token *tokens = NULL; /* see WORKING MEMORY */
+DAN3_TLS int tokens_capacity = 0;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int token_count;
+
+/*
+ * - TOKEN BUFFER -
+ * Sized by the path the parse chose, not by the input (see MEMORY BUDGET).
+ * Grown with realloc: the tokens already pushed are kept.
+ */
+#define TOKENS_STEP	4096
+
+long memory_in_use(long extra);
+
+// Room for count tokens. FALSE when out of memory or over max_memory (extra:
+// bytes held outside the globals, as in note_memory).
+int reserve_tokens(int count, long extra)
+{
+	struct t_token *grown;
+
+	if (count <= tokens_capacity) return TRUE;
+	if (max_memory > 0 && memory_in_use(extra + (long) (count - tokens_capacity) * (long) sizeof(struct t_token)) > max_memory)
+	{
+		if (VERBOSE) printf("C: reserve_tokens: %d tokens do not fit in %d bytes\n", count, max_memory);
+		memory_needed = memory_in_use(extra + (long) (count - tokens_capacity) * (long) sizeof(struct t_token));
+		return FALSE;
+	}
+	grown = (struct t_token *) realloc(tokens, (size_t) count * sizeof(struct t_token));
+	if (grown == NULL) return FALSE;
+	tokens = grown;
+	tokens_capacity = count;
+	return TRUE;
+}
+
+// Tokens on the path from position from back to position to (excluded)
+int count_path(struct t_optimal *table, int from, int to, int subset)
+{
+	int count = 0;
+	while (from > to)
+	{
+		from -= table[from].len[subset];
+		count++;
+	}
+	return count;
+}
+
+/*
+ * - APPEND A PATH TO THE TOKENS -
+ * From position from back to position to (excluded), so in reverse order.
+ * The room is reserved by the caller (count_path).
+ */
+void push_path(struct t_optimal *table, int from, int to, int subset)
+{
+	int len;
+	while (from > to)
+	{
+		len = table[from].len[subset];
+		tokens[token_count].len = len;
+		tokens[token_count].offset = table[from].offset[subset];
+		tokens[token_count].bits = table[from].bits[subset] - table[from - len].bits[subset];
+		token_count++;
+		from -= len;
+	}
+}
+
+/*
+ * - CLOSE THE TOKENS -
+ * Adds the first raw byte and puts the list back in stream order. The room
+ * for it is reserved with the others.
+ */
+void finish_tokens()
+{
+	struct t_token token;
+	int i;
+	tokens[token_count].len = 1;
+	tokens[token_count].offset = 0;
+	tokens[token_count].bits = 8;
+	token_count++;
+	for (i = 0; i < token_count / 2; i++)
+	{
+		token = tokens[i];
+		tokens[i] = tokens[token_count - 1 - i];
+		tokens[token_count - 1 - i] = token;
+	}
+}
+
+int token_kind(struct t_token *token)
+{
+	if (token->offset != 0) return TOKEN_MATCH;
+	return (token->len == 1 ? TOKEN_LITERAL : TOKEN_RLE);
+}
+
+int token_offset_class(struct t_token *token)
+{
+	if (token->offset == 0) return OFFSET_CLASS_NONE;
+	if (token->len == 1) return OFFSET_CLASS_0;
+	if (token->offset > MAX_OFFSET2) return OFFSET_CLASS_3;
+	if (token->offset > MAX_OFFSET1) return OFFSET_CLASS_2;
+	return OFFSET_CLASS_1;
+}
+
+/*
+ * - SPLIT STREAMS -
+ * Opt-in layout for fast decoders (bSPLIT, dan3 -x): the same tokens, but
+ * the control bits (token kinds, RLE/end flag, offset classes and offset
+ * bits), the Golomb gamma lengths and the raw bytes (first byte, literals,
+ * offset low bytes, RLE lengths and runs) each go to a stream of their own:
+ *     0xFF, 0x80|STREAM_SPLIT, 0xFF, control length | 0x800000 (3 bytes,
+ *     big-endian), gamma length (3 bytes, big-endian),
+ *     control bits, gamma bits, raw bytes [, CRC-32 trailer]
+ * The third 0xFF and the high bit of the control length make nine 1 bits, so
+ * transform-aware decoders that predate the flag reject the stream too.
+ * The decoder keeps a cursor per stream: bits come from 64-bit registers
+ * refilled with wide loads, a run of literals is one count of leading 1s
+ * and one copy. Only dan3_decode reads it; the size is within a byte of
+ * the classic stream plus SPLIT_LENGTHS.
+ */
+#define STREAM_SPLIT	16 /* header flag: split streams */
+#define SPLIT_LENGTHS	7
+#define SPLIT_MARK		0x800000
+// Bytes bCRC and bSPLIT add to the bits of the parse (bSPLIT: at most, each
+// stream pads its last byte)
+#define STREAM_FRAME	((bCRC || bSPLIT ? CRC_HEADER : 0) + (bCRC ? CRC_TRAILER : 0) + (bSPLIT ? SPLIT_LENGTHS + 1 : 0))
+
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int bSPLIT = FALSE;
+
+// One output stream; data NULL only counts
+struct t_bits
+{
+	uint8_t *data;
+	int index;
+	int mask;
+};
+
+void put_bits(struct t_bits *s, int value, int size)
+{
+	while (size-- > 0)
+	{
+		if (s->mask == 0)
+		{
+			s->mask = 128;
+			if (s->data != NULL) s->data[s->index] = 0;
+			s->index++;
+		}
+		if (s->data != NULL && ((value >> size) & 1)) s->data[s->index - 1] |= s->mask;
+		s->mask >>= 1;
+	}
+}
+
+void put_gamma(struct t_bits *s, int value)
+{
+	int i;
+	value++;
+	for (i = 4; i <= value; i <<= 1) put_bits(s, 0, 1);
+	while ((i >>= 1) > 0) put_bits(s, (value & i) != 0, 1);
+}
+
+void put_byte(struct t_bits *s, int value)
+{
+	if (s->data != NULL) s->data[s->index] = (uint8_t) value;
+	s->index++;
+}
+
+// The tokens into the three streams, same order and codes as write_lz
+int split_tokens(int subset, struct t_bits *control, struct t_bits *gamma, struct t_bits *bytes)
+{
+	int i, j, index, len, value;
+
+	put_bits(control, 0xFE, subset + 1);
+	put_byte(bytes, ptr_src[0]);
+	index = 1;
+	for (i = 1; i < token_count; i++)
+	{
+		len = tokens[i].len;
+		value = tokens[i].offset - 1;
+		if (DAN3_CHECKED && (len <= 0 || index + len > index_src))
+		{
+			if (VERBOSE) printf("C: ERROR: split_tokens token %d (len=%d) runs past the input at %d!\n", i, len, index);
+			return -1;
+		}
+		if (tokens[i].offset == 0 && len == 1)
+		{
+			put_bits(control, 1, 1);
+			put_byte(bytes, ptr_src[index]);
+		}
+		else if (tokens[i].offset == 0)
+		{
+			put_bits(control, 0, 1);
+			put_bits(gamma, 0, BIT_GOLOMG_MAX);
+			put_bits(control, 1, 1);
+			put_byte(bytes, len - RAW_MIN);
+			for (j = 0; j < len; j++) put_byte(bytes, ptr_src[index + j]);
+		}
+		else
+		{
+			put_bits(control, 0, 1);
+			put_gamma(gamma, len);
+			if (len == 1)
+			{
+				put_bits(control, value >= MAX_OFFSET00, 1);
+				if (value >= MAX_OFFSET00) put_bits(control, value - MAX_OFFSET00, BIT_OFFSET0);
+			}
+			else if (value >= MAX_OFFSET2)
+			{
+				value -= MAX_OFFSET2;
+				put_bits(control, 3, 2);
+				put_bits(control, value >> BIT_OFFSET2, BIT_OFFSET3 - BIT_OFFSET2);
+				put_byte(bytes, value & 255);
+			}
+			else if (value >= MAX_OFFSET1)
+			{
+				put_bits(control, 0, 1);
+				put_byte(bytes, value - MAX_OFFSET1);
+			}
+			else
+			{
+				put_bits(control, 2, 2);
+				put_bits(control, value, BIT_OFFSET1);
+			}
+		}
+		index += len;
+	}
+	// End marker
+	put_bits(control, 0, 1);
+	put_bits(gamma, 0, BIT_GOLOMG_MAX);
+	put_bits(control, 0, 1);
+	return 0;
+}
+
+// Counts the streams, then writes them in place. Returns the stream size.
+int write_split(int subset)
+{
+	struct t_bits control = { NULL, 0, 0 }, gamma = { NULL, 0, 0 }, bytes = { NULL, 0, 0 };
+	int header = CRC_HEADER + SPLIT_LENGTHS;
+	int i;
+	uint32_t crc;
+
+	if (split_tokens(subset, &control, &gamma, &bytes) < 0) return -1;
+	index_dest = header + control.index + gamma.index + bytes.index;
+	if (index_dest + (bCRC ? CRC_TRAILER : 0) > size_dest)
+	{
+		if (VERBOSE) printf("C: ERROR: write_split: %d bytes of output do not fit in %d bytes.\n", index_dest, size_dest);
+		return -1;
+	}
+	ptr_dest[0] = 0xFF;
+	ptr_dest[1] = 0x80 | STREAM_SPLIT | (bCRC ? STREAM_CRC32 : 0);
+	ptr_dest[2] = 0xFF;
+	for (i = 0; i < 3; i++)
+	{
+		ptr_dest[3 + i] = (uint8_t) ((control.index | SPLIT_MARK) >> (16 - 8 * i));
+		ptr_dest[6 + i] = (uint8_t) (gamma.index >> (16 - 8 * i));
+	}
+	if (VERBOSE) printf("C: write_split: control %d, gamma %d, raw %d bytes\n", control.index, gamma.index, bytes.index);
+	control.data = ptr_dest + header;
+	gamma.data = control.data + control.index;
+	bytes.data = gamma.data + gamma.index;
+	control.index = gamma.index = bytes.index = 0;
+	control.mask = gamma.mask = 0;
+	split_tokens(subset, &control, &gamma, &bytes);
+	if (bCRC)
+	{
+		crc = crc32_update(0, ptr_src, index_src);
+		for (i = 0; i < CRC_TRAILER; i++) ptr_dest[index_dest++] = (uint8_t) (crc >> (8 * i));
+	}
+	inplace_margin = -1; // No in-place decoding
+	return index_dest;
+}
+
+// write_lz now returns the final index_dest (compressed size)
+int write_lz(int subset)
+{
+    if (VERBOSE) printf("C: write_lz START for subset %d (BIT_OFFSET_MIN+%d), %d tokens\n", subset, BIT_OFFSET_MIN, token_count);
+	if (bSPLIT) return write_split(subset);
+	int i, j;
+	int index, len, offset;
+	int crc_done = 0;
+	uint32_t crc = 0;
+	index_dest = 0;
+	bit_mask = 0; // Reset bit_mask and bit_index for a new write operation
+	bit_index = 0;
+
+	if (bCRC)
+	{
+		write_byte(0xFF);
+		write_byte(0x80 | STREAM_CRC32);
+	}
+    if (VERBOSE) printf("C: write_lz: Writing header (0xFE, subset+1)\n");
+	write_bits(0xFE, subset + 1);
+    if (VERBOSE) printf("C: write_lz: Writing first raw byte 0x%02X\n", ptr_src[0]);
+	write_byte(ptr_src[0]); // First byte is always written raw (tokens[0])
+	inplace_delta = 0;
+	update_inplace_delta(1);
+
+	index = 1;
+	for (i = 1;i < token_count;i++)
+	{
+		len = tokens[i].len;
+		offset = tokens[i].offset;
+        if (DAN3_CHECKED && (len <= 0 || index + len > index_src)) {
+            if (VERBOSE) printf("C: ERROR: write_lz token %d (len=%d) runs past the input at %d!\n", i, len, index);
+            return -1; // Indicate failure
+        }
+        if (VERBOSE) printf("C: write_lz: pos %d (src: 0x%02X), len=%d, offset=%d, type=%s\n",
+                               index, ptr_src[index], len, offset,
+                               offset == 0 ? (len == 1 ? "Literal" : "RLE") : "Match");
+
+		if (offset == 0)
+		{
+			if (len == 1)
+			{
+				write_literal(ptr_src[index]);
+			}
+			else
+			{
+				write_literals_length(len);
+				for (j = 0;j < len;j++)
+				{
+					write_byte(ptr_src[index + j]);
+				}
+			}
+		}
+		else
+		{
+			write_doublet(len, offset);
+		}
+		index += len;
+		update_inplace_delta(index);
+		if (bCRC && index - crc_done >= CRC_BLOCK)
+		{
+			crc = crc32_update(crc, ptr_src + crc_done, index - crc_done);
+			crc_done = index;
+		}
+	}
+	write_end();
+	if (bCRC)
+	{
+		crc = crc32_update(crc, ptr_src + crc_done, index - crc_done);
+		if (VERBOSE) printf("C: write_lz: CRC-32 trailer 0x%08X\n", crc);
+		for (i = 0; i < CRC_TRAILER; i++) write_byte((unsigned char) (crc >> (8 * i)));
+	}
+	inplace_margin = inplace_delta + index_dest - index_src;
+	if (inplace_margin < 0) inplace_margin = 0;
+    if (VERBOSE) printf("C: write_lz END. Final index_dest: %d, in-place margin: %d\n", index_dest, inplace_margin);
+	return index_dest; // Return the compressed size
+}
+
+/*
+ * - READ SOURCE - (Removed as data comes from JS memory)
+ * IMPORTANT: Corrected comment to avoid nested block comments.
+ */
+// unsigned char read_source() { /* ... */ } // Line 402, was problematic. Changed to //
+
+// Function Prototype: Declare golomb_gamma_bits before it's used in count_bits
+int golomb_gamma_bits(int value);
+
+/*
+ * - GOLOMB GAMMA LIMIT TO 254 -
+ */
+int golomb_gamma_bits(int value)
+{
+	int bits = 0;
+	value++;
+	while (value > 1)
+	{
+		bits += 2;
+		value >>= 1;
+	}
+	return bits;
+}
+
+int count_bits(int offset, int len)
+{
+    if (VERBOSE) printf("C: count_bits: offset=%d, len=%d (BIT_OFFSET3=%d)\n", offset, len, BIT_OFFSET3);
+	int bits = 1 + golomb_gamma_bits(len);
+	if (len == 1)
+	{
+		if (BIT_OFFSET00 == -1) // This condition might be specific to some variant; if BIT_OFFSET00 is always 0, this branch might not be hit.
+		{
+            if (VERBOSE) printf("C: count_bits (len=1, BIT_OFFSET00=-1): %d + %d = %d\n", bits, BIT_OFFSET0, bits + BIT_OFFSET0);
+			return bits + BIT_OFFSET0;
+		}
+		else
+		{
+            int offset_bits = (offset > MAX_OFFSET00 ? BIT_OFFSET0 : BIT_OFFSET00);
+            if (VERBOSE) printf("C: count_bits (len=1, BIT_OFFSET00=0): %d + 1 + %d = %d (offset_bits=%d)\n", bits, offset_bits, bits + 1 + offset_bits, offset_bits);
+			return bits + 1 + offset_bits;
+		}
+	}
+    // For len > 1
+    int offset_cost;
+    if (offset > MAX_OFFSET2) {
+        offset_cost = 1 + BIT_OFFSET3;
+    } else if (offset > MAX_OFFSET1) {
+        offset_cost = BIT_OFFSET2;
+    } else {
+        offset_cost = 1 + BIT_OFFSET1;
+    }
+    if (VERBOSE) printf("C: count_bits (len>1): %d + 1 + %d = %d (offset_cost=%d)\n", bits, offset_cost, bits + 1 + offset_cost, offset_cost);
+	return bits + 1 + offset_cost;
+}
+
+EMSCRIPTEN_KEEPALIVE void set_BIT_OFFSET3(int i)
+{
+    // This function can be called very frequently; verbose print might be too much.
+    // if (VERBOSE) printf("C: set_BIT_OFFSET3(%d): BIT_OFFSET3=%d, MAX_OFFSET3=%d\n", i, BIT_OFFSET_MIN + i, (1 << (BIT_OFFSET_MIN + i)) + MAX_OFFSET2);
+	BIT_OFFSET3 = BIT_OFFSET_MIN + i;
+	MAX_OFFSET3 = (1 << BIT_OFFSET3) + MAX_OFFSET2;
+}
+
+/*
+ * - VECTOR COST UPDATE -
+ * update_optimal() past the first byte, four subsets per vector. A lane keeps
+ * its entry when its subset is outside subset_low..subset_high, when its
+ * predecessor is unreachable or when offset is beyond its MAX_OFFSET3; the
+ * others take the token on a strictly smaller cost, like the scalar loop.
+ */
+#if DAN3_VECTOR
+#if ((BIT_OFFSET_NBR) % 4) != 0
+#error "The vector cost update works on groups of 4 subsets"
+#endif
+void update_optimal_vector(int index, int len, int offset)
+{
+	struct t_optimal *current = &OPTIMAL(index);
+	struct t_optimal *from = &OPTIMAL(index - len);
+	struct t_optimal *before = &OPTIMAL(index - 1);
+	int first = subset_low;
+	int cost, step = 0;
+	int s;
+	v4i32 lane, bits, prev, valid, better, value;
+
+	if (offset == 0)
+	{
+		cost = (len == 1 ? 1 + 8 : 1 + BIT_GOLOMG_MAX + 1 + 8 + len * 8);
+	}
+	else
+	{
+		if (offset > index) return;
+		if (offset > MAX_OFFSET1)
+		{
+			// MAX_OFFSET3 grows with the subset: start at the first one that reaches offset
+			while (first <= subset_high && offset > (1 << (BIT_OFFSET_MIN + first)) + MAX_OFFSET2) first++;
+		}
+		if (len > 1 && offset > MAX_OFFSET2)
+		{
+			// count_bits() for subset 0, plus one bit per subset
+			cost = 1 + golomb_gamma_bits(len) + 1 + 1 + BIT_OFFSET_MIN;
+			step = 1;
+		}
+		else
+		{
+			cost = count_bits(offset, len);
+		}
+	}
+	for (s = first & ~3; s <= subset_high; s += 4)
+	{
+		lane = (v4i32) { s, s + 1, s + 2, s + 3 };
+		memcpy(&bits, &current->bits[s], sizeof(bits));
+		memcpy(&prev, &from->bits[s], sizeof(prev));
+		valid = (lane >= first) & (lane <= subset_high) & (prev != 0x7FFFFFFF);
+		if (offset == 0 && len > 1)
+		{
+			memcpy(&value, &before->bits[s], sizeof(value));
+			valid &= (value != 0x7FFFFFFF);
+		}
+		prev = (prev & valid) + cost + lane * step;
+		better = valid & (prev < bits);
+		bits = (prev & better) | (bits & ~better);
+		memcpy(&current->bits[s], &bits, sizeof(bits));
+		memcpy(&value, &current->offset[s], sizeof(value));
+		value = (better & offset) | (value & ~better);
+		memcpy(&current->offset[s], &value, sizeof(value));
+		memcpy(&value, &current->len[s], sizeof(value));
+		value = (better & len) | (value & ~better);
+		memcpy(&current->len[s], &value, sizeof(value));
+	}
+}
+#endif
+
+void update_optimal(int index, int len, int offset)
+{
+#if DAN3_VECTOR
+	if (index > 0 && !VERBOSE)
+	{
+		update_optimal_vector(index, len, offset);
+		return;
+	}
+#endif
+    // This function is called for every (index, len, offset) combination.
+    // Full verbose output here will be overwhelming for large files.
+    // Only enable if debugging a very specific index.
+    // if (VERBOSE) printf("C: update_optimal START: index=%d, len=%d, offset=%d\n", index, len, offset);
+
+	int i;
+	int cost;
+	i = subset_high;
+	while (i >= subset_low)
+	{
+        // if (VERBOSE) printf("C:   update_optimal: checking subset %d\n", i);
+        if (DAN3_CHECKED && (index < 0 || index >= MAX)) {
+            if (VERBOSE) printf("C: CRITICAL ERROR: update_optimal index (%d) out of bounds for optimals array! Aborting.\n", index);
+            emscripten_console_log("C-CRITICAL: update_optimal index OOB!");
+            EM_ASM({ debugger; });
+            abort();
+        }
+
+		if (offset == 0) // Literal or RLE
+		{
+			if (index > 0)
+			{
+                int prev_bits_idx = (index - 1);
+                // Defensive check before accessing OPTIMAL(index-1)
+                if (DAN3_CHECKED && (prev_bits_idx < 0 || prev_bits_idx >= MAX)) {
+                    if (VERBOSE) printf("C: CRITICAL ERROR: update_optimal prev_bits_idx (%d) out of bounds for optimals array! Aborting.\n", prev_bits_idx);
+                    emscripten_console_log("C-CRITICAL: update_optimal prev_bits_idx OOB!");
+                    EM_ASM({ debugger; });
+                    abort();
+                }
+                if (OPTIMAL(index-1).bits[i] == 0x7FFFFFFF) { // If previous state is unreachable
+                    // if (VERBOSE) printf("C:     update_optimal: prev state (index-1) unreachable for subset %d\n", i);
+                    i--;
+                    continue;
+                }
+
+				if (len == 1)
+				{
+					// Literal: cost = previous_cost + 1_bit_flag + 8_bits_data
+					cost = OPTIMAL(prev_bits_idx).bits[i] + 1 + 8;
+					if (OPTIMAL(index).bits[i] > cost)
+					{
+                        // if (VERBOSE) printf("C:       update_optimal: Literal improved for subset %d, cost %d -> %d\n", i, OPTIMAL(index).bits[i], cost);
+					    OPTIMAL(index).bits[i] = cost;
+					    OPTIMAL(index).offset[i] = 0;
+					    OPTIMAL(index).len[i] = 1;
+                    }
+				}
+				else // RLE
+				{
+                    int prev_len_bits_idx = (index - len);
+                    // Defensive check before accessing OPTIMAL(index-len)
+                    if (DAN3_CHECKED && (prev_len_bits_idx < 0 || prev_len_bits_idx >= MAX)) {
+                        if (VERBOSE) printf("C: CRITICAL ERROR: update_optimal prev_len_bits_idx (%d) out of bounds for optimals array! Aborting.\n", prev_len_bits_idx);
+                        emscripten_console_log("C-CRITICAL: update_optimal prev_len_bits_idx OOB!");
+                        EM_ASM({ debugger; });
+                        abort();
+                    }
+                    if (OPTIMAL(prev_len_bits_idx).bits[i] == 0x7FFFFFFF) { // If previous RLE base state unreachable
+                        // if (VERBOSE) printf("C:     update_optimal: prev RLE state (index-len=%d) unreachable for subset %d\n", prev_len_bits_idx, i);
+                        i--;
+                        continue;
+                    }
+					cost = OPTIMAL(prev_len_bits_idx).bits[i] + 1 + BIT_GOLOMG_MAX + 1 + 8 + len * 8;
+					if (OPTIMAL(index).bits[i] > cost)
+					{
+                        // if (VERBOSE) printf("C:       update_optimal: RLE len=%d improved for subset %d, cost %d -> %d\n", len, i, OPTIMAL(index).bits[i], cost);
+						OPTIMAL(index).bits[i] = cost;
+						OPTIMAL(index).offset[i] = 0;
+						OPTIMAL(index).len[i] = len;
+					}
+				}
+			}
+			else // index == 0 (first byte)
+			{
+				OPTIMAL(index).bits[i] = 8;
+				OPTIMAL(index).offset[i] = 0;
+				OPTIMAL(index).len[i] = 1;
+                // if (VERBOSE) printf("C:       update_optimal: First byte, cost = 8 for subset %d\n", i);
+			}
+		}
+		else // Match
+		{
+			if (offset > index) { // Invalid offset (match goes before start of data_src)
+                if (VERBOSE) printf("C:     update_optimal: Match offset %d > index %d, invalid for subset %d\n", offset, index, i);
+				i--;
+				continue;
+			}
+
+            int prev_match_bits_idx = (index - len);
+            // Defensive check before accessing OPTIMAL(index-len)
+            if (DAN3_CHECKED && (prev_match_bits_idx < 0 || prev_match_bits_idx >= MAX)) {
+                if (VERBOSE) printf("C: CRITICAL ERROR: update_optimal prev_match_bits_idx (%d) out of bounds for optimals array! Aborting.\n", prev_match_bits_idx);
+                emscripten_console_log("C-CRITICAL: update_optimal prev_match_bits_idx OOB!");
+                EM_ASM({ debugger; });
+                abort();
+            }
+            if (OPTIMAL(prev_match_bits_idx).bits[i] == 0x7FFFFFFF) { // If previous match base state unreachable
+                // if (VERBOSE) printf("C:     update_optimal: prev match state (index-len=%d) unreachable for subset %d\n", prev_match_bits_idx, i);
+                i--;
+                continue;
+            }
+
+			if (offset > MAX_OFFSET1)
+			{
+				set_BIT_OFFSET3(i);
+				if (offset > MAX_OFFSET3) {
+                    if (VERBOSE) printf("C:     update_optimal: Match offset %d > MAX_OFFSET3 (%d) for subset %d. Skipping.\n", offset, MAX_OFFSET3, i);
+                    i--; // Decrement i before continuing the loop
+                    continue; // Offset too large for this subset, try next subset
+                }
+			}
+			cost = OPTIMAL(prev_match_bits_idx).bits[i] + count_bits(offset, len);
+			if (OPTIMAL(index).bits[i] > cost)
+			{
+                // if (VERBOSE) printf("C:       update_optimal: Match len=%d offset=%d improved for subset %d, cost %d -> %d\n", len, offset, i, OPTIMAL(index).bits[i], cost);
+				OPTIMAL(index).bits[i] = cost;
+				OPTIMAL(index).offset[i] = offset;
+				OPTIMAL(index).len[i] = len;
+			}
+		}
+		i--;
+	}
+    // if (VERBOSE) printf("C: update_optimal END.\n");
+}
+
+/*
+ * - REMOVE USELESS FOUND OPTIMALS -
+ */
+EMSCRIPTEN_KEEPALIVE void cleanup_optimals(int subset)
+{
+    if (VERBOSE) printf("C: cleanup_optimals START for subset %d (index_src=%d)\n", subset, index_src);
+	int j;
+	int i = index_src - 1;
+	int len;
+	while (i > 1) // Loop from end backwards
+	{
+        if (DAN3_CHECKED && (i < 0 || i >= MAX)) {
+            if (VERBOSE) printf("C: ERROR: cleanup_optimals loop index i (%d) out of bounds (0-%d)\n", i, MAX-1);
+            break; // Stop processing this optimal
+        }
+        if (DAN3_CHECKED && (subset < 0 || subset >= BIT_OFFSET_NBR)) {
+            if (VERBOSE) printf("C: ERROR: cleanup_optimals subset (%d) out of bounds (0-%d)\n", subset, BIT_OFFSET_NBR-1);
+            break; // Stop processing
+        }
+
+		len = optimals[i].len[subset];
+        // if (VERBOSE) printf("C:   cleanup_optimals: at index %d, len = %d\n", i, len);
+
+        if (len <= 0) { // If it's a literal or already cleaned up
+             i--; // Move to previous position
+             continue; // Nothing to clean before this point related to this segment
+        }
+
+		for (j = i - 1; j > i - len;j--) // Clean up positions covered by this optimal token
+		{
+            if (DAN3_CHECKED && (j < 0 || j >= MAX)) {
+                if (VERBOSE) printf("C: ERROR: cleanup_optimals inner loop index j (%d) out of bounds!\n", j);
+                break; // Prevent crash
+            }
+            if (optimals[j].offset[subset] != 0 || optimals[j].len[subset] != 0) {
+                 if (VERBOSE) printf("C:     cleanup_optimals: Clearing index %d (was offset=%d, len=%d)\n", j, optimals[j].offset[subset], optimals[j].len[subset]);
+            }
+			optimals[j].offset[subset] = 0;
+			optimals[j].len[subset] = 0;
+		}
+		i = i - len; // Jump back to the start of the current optimal token
+	}
+    if (VERBOSE) printf("C: cleanup_optimals END.\n");
+}
+
+/* DAN3 Encoder - Decoder (Emscripten Friendly with Debug Prints)
+ * Fixed bounds checking issue in LZ MATCH OF 2+ section
+ * The key fix: Move bounds checking BEFORE calling update_optimal()
+ */
+
+// ... [Keep all the existing includes and defines as they are] ...
+
+// In the lzss_slow() function, replace the problematic section with this fixed version:
+
+/*
+ * - BRANCH AND BOUND -
+ * Most tokens offered to update_optimal replace nothing: the literal offered
+ * first already bounds the cost of each subset at the position from above.
+ * The potential of a position sums, from the start of the parse, the largest
+ * cost increase of a live subset at each position. Between positions p and i
+ * no subset gains more than potential(i) - potential(p), so a token from p
+ * to i whose cheapest encoding (offset class of subset_low) costs that much
+ * would not lower any cost (update_optimal only replaces on a smaller cost)
+ * and is not offered. Only tokens that cannot change the table are skipped:
+ * the output is byte-identical to the exhaustive parse. bBOUND = FALSE offers
+ * them all, for comparison.
+ */
+#define BOUND_UNKNOWN	(-0x7FFFFFFF - 1)
+
+// Potential of position index from the costs offered so far, BOUND_UNKNOWN
+// when a subset is unreachable at index or index-1 (the start of a parse)
+int bound_potential(int index)
+{
+	int i, step, highest;
+	if (!bBOUND || index < 1 || OPTIMAL(index-1).potential == BOUND_UNKNOWN) return BOUND_UNKNOWN;
+	highest = BOUND_UNKNOWN;
+	for (i = subset_low; i <= subset_high; i++)
+	{
+		if (OPTIMAL(index).bits[i] == 0x7FFFFFFF || OPTIMAL(index-1).bits[i] == 0x7FFFFFFF) return BOUND_UNKNOWN;
+		step = OPTIMAL(index).bits[i] - OPTIMAL(index-1).bits[i];
+		if (step > highest) highest = step;
+	}
+	return OPTIMAL(index-1).potential + highest;
+}
+
+// TRUE when a token from position from costing at least cost cannot lower
+// a cost at the position of the given potential
+#define BOUNDED(from, cost, potential)	((potential) != BOUND_UNKNOWN && OPTIMAL(from).potential != BOUND_UNKNOWN \
+	&& (cost) >= (potential) - OPTIMAL(from).potential)
+
+/*
+ * - SCAN ONE POSITION -
+ * Offers every token ending at position i (literal, RLE, matches) to the DP.
+ * prev_match_index is the prefix key returned for position i-1, or -1 when the
+ * scan starts at i. Returns the prefix key of position i.
+ * Runs and periodic data put every earlier position of the window in the
+ * chain. The chain goes from the closest offset outwards, and a closer offset
+ * never costs more than a farther one for the same length and fits every
+ * subset the farther one fits. Once a match reached the longest length the
+ * next offset could have, that offset and all the farther ones (which can only
+ * be shorter) would not improve any cost, and the walk stops. The DP and the
+ * output are unchanged; on repetitive data the walk is one or two entries.
+ */
+int scan_position(int i, int prev_match_index)
+{
+	int best_len;
+	int reach; /* longest match of the closer offsets */
+	int depth;
+	int len;
+	int j, k;
+	int offset;
+	int match_index;
+	int match;
+	int potential; /* see BRANCH AND BOUND */
+	int offset_bits;
+
+	/* TRY LITERALS */
+	update_optimal(i, 1, 0);
+	potential = bound_potential(i);
+
+	/* STRING OF LITERALS (RLE) */
+	if (bRLE)
+	{
+		if (i >= RAW_MIN)
+		{
+			j = RAW_MAX;
+			if (j > i) j = i;
+			if (RAW_MIN == 1)
+			{
+				for (k = j ; k > RAW_MIN; k--)
+				{
+					if (BOUNDED(i - k, 1 + BIT_GOLOMG_MAX + 1 + 8 + k * 8, potential)) continue;
+					update_optimal(i, k, 0);
+				}
+			}
+			else
+			{
+				/* RAW MINIMUM > 1 */
+				for (k = j ; k >= RAW_MIN; k--)
+				{
+					if (BOUNDED(i - k, 1 + BIT_GOLOMG_MAX + 1 + 8 + k * 8, potential)) continue;
+					update_optimal(i, k, 0);
+				}
+			}
+		}
+	}
+
+	/* LZ MATCH OF 1 */
+	j = (BIT_OFFSET00 == -1 ? (1 << BIT_OFFSET0) : MAX_OFFSET0);
+	if (j > i) j = i;
+	for (k = 1; k <= j; k++)
+	{
+        // Check data_src bounds before access in LZ MATCH OF 1
+        if (DAN3_CHECKED && (i < 0 || i >= MAX || (i - k) < 0 || (i - k) >= MAX)) {
+            if (VERBOSE) printf("C: CRITICAL ERROR: LZ MATCH OF 1 data_src[%d] or data_src[%d] out of bounds (i=%d, k=%d)! Aborting.\n", i, i-k, i, k);
+            emscripten_console_log("C-CRITICAL: LZ MATCH OF 1 OOB!");
+            EM_ASM({ debugger; });
+            abort();
+        }
+		if (ptr_src[i] == ptr_src[i-k])
+		{
+			update_optimal(i, 1, k);
+		}
+	}
+	potential = bound_potential(i);
+
+	/* LZ MATCH OF 2+ - FIXED VERSION */
+    if (DAN3_CHECKED && (i -1 < 0 || i >= MAX)) { // Defensive check for ptr_src[i-1]
+        if (VERBOSE) printf("C: ERROR: LZ MATCH OF 2+ (i=%d) out of bounds for data_src[%d]\n", i, i-1);
+        // Potentially return error.
+        return -1; // Cannot process, reset
+    } else {
+	    match_index = ((int) ptr_src[i-1]) << 8 | ((int) ptr_src[i] & 255);
+
+	    if (prev_match_index == match_index && bFAST == TRUE && OPTIMAL(i-1).offset[subset_low] == 1 && OPTIMAL(i-1).len[subset_low] > 2)
+	    {
+		    len = OPTIMAL(i-1).len[subset_low];
+		    if (len < MAX_GAMMA)
+            {
+                // BOUNDS CHECK BEFORE update_optimal call
+                if (i >= len && i - len >= 0 && i - len < MAX) {
+			        update_optimal(i, len + 1, 1);
+                }
+            }
+	    }
+	    else
+	    {
+		    best_len = 1;
+		    reach = 0;
+		    depth = 0;
+		    for (match = match_prev[i]; match >= 0; match = match_prev[match])
+		    {
+			    offset = i - match;
+			    if (offset > MAX_OFFSET)
+			    {
+				    break; // Older matches are out of reach
+			    }
+			    if (chain_depth && ++depth > chain_depth)
+			    {
+				    break; // Time budget: only the closest offsets
+			    }
+			    if (reach >= (i - offset < MAX_GAMMA ? i - offset : MAX_GAMMA))
+			    {
+				    break; // Closer offsets already covered every length left
+			    }
+			    best_len = 1;
+                if (DAN3_CHECKED && (offset <= 0 || i - offset < 0)) { // Defensive check for offset validity
+                    if (VERBOSE) printf("C: ERROR: LZ MATCH OF 2+ (i=%d, offset=%d) invalid for match. Skipping.\n", i, offset);
+                    continue;
+                }
+			    set_BIT_OFFSET3(subset_low);
+			    offset_bits = count_bits(offset, 2) - golomb_gamma_bits(2);
+			    
+                // FIXED: Check bounds BEFORE trying different lengths
+			    for (len = 2; len <= MAX_GAMMA; len++)
+			    {
+                    // CRITICAL FIX: Move bounds check BEFORE update_optimal call
+                    if (i - len < 0 || (i - len - offset) < 0 || (i - len) >= MAX || (i - len - offset) >= MAX) {
+                        if (VERBOSE) printf("C: BOUNDS: LZ MATCH OF 2+ would access out of bounds for len=%d, offset=%d at i=%d. Breaking.\n", len, offset, i);
+                        break; // Stop trying longer lengths for this offset
+                    }
+                    
+                    // Now it's safe to call update_optimal
+				    if (!BOUNDED(i - len, offset_bits + golomb_gamma_bits(len), potential))
+				    {
+					    update_optimal(i, len, offset);
+				    }
+				    best_len = len;
+                    
+                    // Check if the match continues (this is the original match verification logic)
+				    if (i < offset + len || ptr_src[i-len] != ptr_src[i-len-offset])
+				    {
+					    break;
+				    }
+			    }
+			    if (best_len > reach) reach = best_len;
+			    if (bFAST && best_len > 255) break;
+			    potential = bound_potential(i);
+		    }
+	    }
+	    OPTIMAL(i).potential = bound_potential(i);
+	    return match_index;
+    }
+}
+
+/*
+ * - CLOCK - (milliseconds, for the time budget)
+ */
+double now_ms()
+{
+#ifdef __EMSCRIPTEN__
+	return emscripten_get_now();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+#endif
+}
+
+/*
+ * - SUBSET PRUNING -
+ * Subsets wider than the input needs are dropped outright: the narrower one
+ * reaches every offset for fewer bits. The others are estimated with a greedy
+ * parse walked back from the end over the hash chains. Each match it takes is
+ * priced, in every subset, with the longest match that subset can reach and
+ * literals for the rest. Subsets estimated more than 1/PRUNE_SLACK above the
+ * best one are left out of the DP. Under a time budget the estimate gives up
+ * at prune_stop_ms and every subset is kept. The steps of the greedy parse
+ * are also the token estimate of the memory budget.
+ */
+#define PRUNE_SLACK		32
+#define PRUNE_CLASSES	(2 + BIT_OFFSET_NBR) /* short, medium, then long per subset */
+
+DAN3_TLS double prune_stop_ms = 0; /* 0 = no time limit */
+DAN3_TLS int token_estimate = 0; /* 0 = not estimated (all positions), -1 = before prune_subsets */
+
+void prune_subsets()
+{
+	int class_len[PRUNE_CLASSES];
+	int class_offset[PRUNE_CLASSES];
+	int estimate[BIT_OFFSET_NBR] = { 0 };
+	int i, c, s;
+	int len, best_len;
+	int offset, match;
+	int cost, best;
+	int last;
+	int steps = 0;
+	int tokens = 1; /* The first raw byte */
+
+	token_estimate = 0;
+	subset_low = 0;
+	subset_high = BIT_OFFSET_NBR_ALLOWED - 1;
+	while (subset_high > 0 && index_src - 1 <= (1 << (BIT_OFFSET_MIN + subset_high - 1)) + MAX_OFFSET2) subset_high--;
+	if (!bPRUNE || subset_high == 0)
+	{
+		if (VERBOSE) printf("C: prune_subsets: subsets %d..%d\n", subset_low, subset_high);
+		return;
+	}
+
+	last = subset_high;
+	for (s = 0; s <= last; s++) estimate[s] = s + 1;
+	i = index_src - 1;
+	while (i > 0)
+	{
+		if (prune_stop_ms > 0 && (++steps & 255) == 0 && now_ms() > prune_stop_ms)
+		{
+			if (VERBOSE) printf("C: prune_subsets: out of time, subsets %d..%d\n", subset_low, subset_high);
+			return;
+		}
+		best_len = 1;
+		for (c = 0; c < PRUNE_CLASSES; c++) class_len[c] = 0;
+		for (match = match_prev[i]; match >= 0; match = match_prev[match])
+		{
+			offset = i - match;
+			if (offset > MAX_OFFSET) break;
+			if (best_len >= (i - offset < MAX_GAMMA ? i - offset : MAX_GAMMA)) break; // As in scan_position
+			if (i - 2 - offset < 0) continue;
+			for (len = 2; len < MAX_GAMMA && i - len - 1 - offset >= 0 && ptr_src[i-len] == ptr_src[i-len-offset]; len++);
+			if (offset <= MAX_OFFSET1) c = 0;
+			else if (offset <= MAX_OFFSET2) c = 1;
+			else for (c = 2; offset > (1 << (BIT_OFFSET_MIN + c - 2)) + MAX_OFFSET2; c++);
+			if (len > class_len[c])
+			{
+				class_len[c] = len;
+				class_offset[c] = offset;
+			}
+			if (len > best_len) best_len = len;
+		}
+		for (s = 0; s <= last; s++)
+		{
+			set_BIT_OFFSET3(s);
+			best = 9 * best_len;
+			for (c = 0; c < 3 + s; c++)
+			{
+				if (class_len[c] < 2) continue;
+				cost = count_bits(class_offset[c], class_len[c]) + 9 * (best_len - class_len[c]);
+				if (cost < best) best = cost;
+			}
+			estimate[s] += best;
+		}
+		i -= best_len;
+		tokens++;
+	}
+	token_estimate = tokens;
+
+	best = estimate[0];
+	for (s = 1; s <= last; s++) if (estimate[s] < best) best = estimate[s];
+	while (estimate[subset_low] > best + best / PRUNE_SLACK) subset_low++;
+	while (estimate[subset_high] > best + best / PRUNE_SLACK) subset_high--;
+	if (VERBOSE)
+	{
+		for (s = 0; s <= last; s++) printf("C: prune_subsets: subset %d estimate %d\n", s, estimate[s]);
+		printf("C: prune_subsets: subsets %d..%d\n", subset_low, subset_high);
+	}
+}
+
+#ifndef __EMSCRIPTEN__
+/*
+ * - PARALLEL OPTIMAL PARSE -
+ * With nThreads > 1 the input is cut into one segment per thread. Each thread
+ * runs the DP over its segment in a table of its own, starting SEGMENT_OVERLAP
+ * bytes early, while the hash chains are built once and shared. The paths are
+ * then stitched from the last segment back: segment k joins segment k-1 at the
+ * token boundary of its path, inside the overlap, where the two DP costs agree
+ * best. Once both paths have converged the stitch costs nothing, so the output
+ * stays within a few bits per segment of the serial parse.
+ */
+#define SEGMENT_OVERLAP	4096
+#define SEGMENT_MIN		(4*SEGMENT_OVERLAP)
+#define SEGMENT_NBR		64
+
+/*
+ * - STATE OF A PARSE THREAD -
+ * The codec state is per thread (DAN3_TLS): encodes running on different
+ * threads, as the jobs of the Node.js addon do, never see each other's. A
+ * parse thread starts with a copy of what scan_position() reads from the
+ * encode that started it; its cost table comes with the segment or variant.
+ */
+struct t_parse_state
+{
+	unsigned char *src;
+	int src_len;
+	int *prev; /* match_prev */
+	int depth; /* chain_depth */
+	int low, high; /* subset_low, subset_high */
+	int bound; /* bBOUND */
+	int rle, fast;
+};
+
+void save_parse_state(struct t_parse_state *state)
+{
+	state->src = ptr_src;
+	state->src_len = index_src;
+	state->prev = match_prev;
+	state->depth = chain_depth;
+	state->low = subset_low;
+	state->high = subset_high;
+	state->bound = bBOUND;
+	state->rle = bRLE;
+	state->fast = bFAST;
+}
+
+void load_parse_state(const struct t_parse_state *state)
+{
+	ptr_src = state->src;
+	index_src = state->src_len;
+	match_prev = state->prev;
+	chain_depth = state->depth;
+	subset_low = state->low;
+	subset_high = state->high;
+	bBOUND = state->bound;
+	bRLE = state->rle;
+	bFAST = state->fast;
+}
+
+struct t_segment
+{
+	int start; /* first position parsed, overlap included */
+	int end;   /* one past the last position */
+	int base;  /* first position in the table */
+	struct t_optimal *table; /* indexed by position: entries base..end-1 */
+	struct t_parse_state state; /* of the calling thread */
+	pthread_t thread;
+};
+
+// Range of segment k of an n byte input. Tokens reach back at most RAW_MAX
+// positions, so the table starts RAW_MAX + 1 positions before the segment.
+void segment_bounds(struct t_segment *segment, int n, int k, int nsegments)
+{
+	segment->start = (int) ((long) n * k / nsegments);
+	if (k > 0) segment->start -= SEGMENT_OVERLAP;
+	segment->end = (int) ((long) n * (k + 1) / nsegments);
+	segment->base = segment->start - (RAW_MAX) - 1;
+	if (segment->base < 0) segment->base = 0;
+}
+
+// Bytes of the tables of nsegments segments
+long segment_tables(int n, int nsegments)
+{
+	struct t_segment segment;
+	long entries = 0;
+	int k;
+
+	for (k = 0; k < nsegments; k++)
+	{
+		segment_bounds(&segment, n, k, nsegments);
+		entries += segment.end - segment.base;
+	}
+	return entries * (long) sizeof(struct t_optimal);
+}
+
+void *parse_segment(void *arg)
+{
+	struct t_segment *segment = (struct t_segment *) arg;
+	int i, x, y;
+	int prev_match_index = -1;
+
+	load_parse_state(&segment->state);
+	optimals = segment->table;
+	optimals_mask = -1;
+	for (x = segment->base; x < segment->end; x++)
+	{
+		for (y = 0; y < BIT_OFFSET_NBR; y++)
+		{
+			optimals[x].bits[y] = 0x7FFFFFFF;
+			optimals[x].offset[y] = 0;
+			optimals[x].len[y] = 0;
+		}
+		optimals[x].potential = BOUND_UNKNOWN;
+	}
+	if (segment->start == 0)
+	{
+		update_optimal(0, 1, 0);
+		optimals[0].potential = 0;
+		i = 1;
+	}
+	else
+	{
+		// A token starts at the segment start: the position before costs nothing
+		for (y = 0; y < BIT_OFFSET_NBR; y++) optimals[segment->start - 1].bits[y] = 0;
+		optimals[segment->start - 1].potential = 0;
+		i = segment->start;
+	}
+	for (; i < segment->end; i++)
+	{
+		prev_match_index = scan_position(i, prev_match_index);
+	}
+	return NULL;
+}
+
+/*
+ * - STITCH SEGMENT PATHS -
+ * Walks the paths back from the end for one subset. cuts[k] receives the
+ * position where segment k takes over from segment k-1. Returns the cost.
+ */
+int stitch_segments(struct t_segment *segments, int nsegments, int subset, int *cuts)
+{
+	struct t_optimal *table, *previous;
+	int k, p, cut, cost, best;
+	int from = index_src - 1;
+	int bits = 0;
+
+	for (k = nsegments - 1; k > 0; k--)
+	{
+		table = segments[k].table;
+		previous = segments[k - 1].table;
+		if (table[from].bits[subset] == 0x7FFFFFFF) return 0x7FFFFFFF; // Pruned subset
+		cut = segments[k].start - 1;
+		best = previous[cut].bits[subset];
+		for (p = from; p >= segments[k].start; p -= table[p].len[subset])
+		{
+			if (p >= segments[k - 1].end || previous[p].bits[subset] == 0x7FFFFFFF) continue;
+			cost = previous[p].bits[subset] - table[p].bits[subset];
+			if (cost < best)
+			{
+				best = cost;
+				cut = p;
+			}
+		}
+		if (best == 0x7FFFFFFF) return 0x7FFFFFFF;
+		bits += table[from].bits[subset] - table[cut].bits[subset];
+		cuts[k] = cut;
+		from = cut;
+	}
+	if (segments[0].table[from].bits[subset] == 0x7FFFFFFF) return 0x7FFFFFFF;
+	return bits + segments[0].table[from].bits[subset];
+}
+
+int lzss_segmented()
+{
+	struct t_segment segments[SEGMENT_NBR];
+	int cuts[SEGMENT_NBR];
+	int nsegments, i, j, k, p;
+	int bits_minimum_temp, bits_minimum;
+	int compressed_size;
+	int result = -1;
+	long tables = 0;
+
+	nsegments = memory_threads; // See MEMORY BUDGET
+	if (VERBOSE) printf("C: lzss_segmented START. index_src: %d, %d segments\n", index_src, nsegments);
+
+	for (k = 0; k < nsegments; k++)
+	{
+		segment_bounds(&segments[k], index_src, k, nsegments);
+		save_parse_state(&segments[k].state);
+		// Entries base..end-1 only, the pointer is moved back by base
+		segments[k].table = (struct t_optimal *) malloc(sizeof(struct t_optimal) * (segments[k].end - segments[k].base));
+		if (segments[k].table == NULL)
+		{
+			if (VERBOSE) printf("C: ERROR: lzss_segmented: no memory for segment %d\n", k);
+			nsegments = k;
+			goto done;
+		}
+		segments[k].table -= segments[k].base;
+		tables += (long) sizeof(struct t_optimal) * (segments[k].end - segments[k].base);
+	}
+	note_memory(tables);
+	for (k = 1; k < nsegments; k++)
+	{
+		if (pthread_create(&segments[k].thread, NULL, parse_segment, &segments[k]) != 0)
+		{
+			// Not enough threads: parse it here
+			segments[k].thread = pthread_self();
+		}
+	}
+	parse_segment(&segments[0]);
+	optimals = optimals_table;
+	for (k = 1; k < nsegments; k++)
+	{
+		if (pthread_equal(segments[k].thread, pthread_self()))
+		{
+			parse_segment(&segments[k]);
+			optimals = optimals_table;
+		}
+		else pthread_join(segments[k].thread, NULL);
+	}
+	if (VERBOSE) printf("C: lzss_segmented: Scan done.\n");
+
+	// Select the best subset from the stitched costs
+	bits_minimum = 0x7FFFFFFF;
+	j = 0;
+	for (i = 0; i < BIT_OFFSET_NBR_ALLOWED; i++)
+	{
+		bits_minimum_temp = stitch_segments(segments, nsegments, i, cuts);
+		if (VERBOSE) printf("C: lzss_segmented: Subset %d (%d bits) cost: %d\n", i, BIT_OFFSET_MIN + i, bits_minimum_temp);
+		if (bits_minimum_temp < bits_minimum)
+		{
+			bits_minimum = bits_minimum_temp;
+			j = i;
+		}
+	}
+	if (bits_minimum == 0x7FFFFFFF)
+	{
+		if (VERBOSE) printf("C: ERROR: lzss_segmented: All subsets unreachable. Cannot compress.\n");
+		goto done;
+	}
+	compressed_size = (j + 1 + bits_minimum + 1 + BIT_GOLOMG_MAX + 1 + 7) / 8 + STREAM_FRAME;
+	if (bPREDICT)
+	{
+		result = compressed_size;
+		goto done;
+	}
+	if (!bSPLIT && compressed_size > size_dest) // write_split checks its exact size
+	{
+		if (VERBOSE) printf("C: ERROR: lzss_segmented: %d bytes of output do not fit in %d bytes.\n", compressed_size, size_dest);
+		goto done;
+	}
+
+	// Walk the stitched path into the token list
+	stitch_segments(segments, nsegments, j, cuts);
+	token_count = 1; // The first raw byte
+	p = index_src - 1;
+	for (k = nsegments - 1; k >= 0; k--)
+	{
+		token_count += count_path(segments[k].table, p, (k > 0 ? cuts[k] : 0), j);
+		if (k > 0) p = cuts[k];
+	}
+	if (!reserve_tokens(token_count, tables)) goto done;
+	token_count = 0;
+	p = index_src - 1;
+	for (k = nsegments - 1; k >= 0; k--)
+	{
+		push_path(segments[k].table, p, (k > 0 ? cuts[k] : 0), j);
+		if (k > 0) p = cuts[k];
+	}
+	finish_tokens();
+	note_memory(tables);
+	set_BIT_OFFSET3(j);
+	result = write_lz(j);
+
+done:
+	for (k = 0; k < nsegments; k++) free(segments[k].table + segments[k].base);
+	return result;
+}
+#endif
+
+/*
+ * - LOW MEMORY MODE HELPERS -
+ */
+void clear_optimal(int index)
+{
+	int y;
+	for (y = 0; y < BIT_OFFSET_NBR; y++)
+	{
+		OPTIMAL(index).bits[y] = 0x7FFFFFFF;
+		OPTIMAL(index).offset[y] = 0;
+		OPTIMAL(index).len[y] = 0;
+	}
+	OPTIMAL(index).potential = BOUND_UNKNOWN;
+}
+
+void save_back_pointers(int index)
+{
+	uint32_t *back_pointer = back_pointers + (size_t) (index - back_pointer_first) * (subset_high - subset_low + 1);
+	int y;
+	for (y = subset_low; y <= subset_high; y++)
+	{
+		*back_pointer++ = (uint32_t) OPTIMAL(index).len[y] | (uint32_t) OPTIMAL(index).offset[y] << 9;
+	}
+}
+
+// Back to the full table once the back-pointers are no longer needed
+void release_ring()
+{
+	free(back_pointers);
+	back_pointers = NULL;
+	back_pointers_count = 0;
+	back_pointer_first = 0;
+	free(checkpoints);
+	checkpoints = NULL;
+	checkpoint_count = 0;
+	optimals = optimals_table;
+	optimals_mask = -1;
+}
+
+void save_checkpoint(int chunk, int prev_match_index)
+{
+	memcpy(checkpoints[chunk].ring, optimals_ring, sizeof(optimals_ring));
+	checkpoints[chunk].prev_match_index = prev_match_index;
+}
+
+/*
+ * - MEMORY BUDGET -
+ * With max_memory set, lzss_prepare() sizes the encode before the parse. It
+ * takes the first of these that fits:
+ * 1. the full cost table, with as many parse threads as the segment tables
+ *    allow (-l skips it);
+ * 2. low memory mode: the cost ring, and back-pointers for every position;
+ * 3. chunked back-pointers: the ring is saved every memory_chunk positions
+ *    during the scan. The backtrack scans each chunk again from its
+ *    checkpoint, so only one chunk of back-pointers is held. The output is
+ *    the same, and the scan takes about twice as long;
+ * 4. as 3, without the longest offset sizes (a smaller window) until it fits.
+ * Every layout needs match_head and optimals_ring (static, 306 KB
+ * whatever the input), match_prev (4 bytes per position) and the tokens:
+ * below that the encode fails, and memory_needed holds the budget it needed. The tokens are allocated after the parse, as many
+ * as the chosen path has. The plan reserves room for TOKEN_SLACK times the
+ * greedy estimate of prune_subsets (all positions without one); a path with
+ * more tokens than fit fails then. memory_peak is measured on the buffers
+ * actually held (input and output belong to the caller).
+ */
+// Bytes held by the encoder, plus extra allocated outside these globals
+long memory_in_use(long extra)
+{
+	return (long) sizeof(match_head) + (long) sizeof(optimals_ring) + extra
+		+ (long) match_prev_capacity * (long) sizeof(int)
+		+ (long) tokens_capacity * (long) sizeof(struct t_token)
+		+ (long) optimals_table_capacity * (long) sizeof(struct t_optimal)
+		+ (long) back_pointers_count * (long) sizeof(uint32_t)
+		+ (long) checkpoint_count * (long) sizeof(struct t_checkpoint);
+}
+
+void note_memory(long extra)
+{
+	long bytes = memory_in_use(extra);
+	if (bytes > memory_peak) memory_peak = bytes;
+}
+
+#define TOKEN_SLACK	3 / 2 /* The optimal path has up to a third more tokens than the greedy one */
+
+// Room kept for the tokens of an n byte input
+int token_reserve(int n)
+{
+	long count = (token_estimate > 0 ? (long) token_estimate * TOKEN_SLACK + 1 : n + 1L);
+
+	if (token_estimate < 0) return 0; // Not known yet: match_prev alone
+	return (int) (count < n + 1L ? count : n + 1L);
+}
+
+// match_prev and the tokens: every layout needs them
+long memory_floor(int n)
+{
+	return (long) sizeof(match_head) + (long) sizeof(optimals_ring)
+		+ (long) n * (long) sizeof(int) + (long) token_reserve(n) * (long) sizeof(struct t_token);
+}
+
+long memory_full(int n)
+{
+	return memory_floor(n) + (long) n * (long) sizeof(struct t_optimal);
+}
+
+long memory_chunked(int n, int subsets, int chunk)
+{
+	return memory_floor(n) + (long) ((n + chunk - 1) / chunk) * (long) sizeof(struct t_checkpoint)
+		+ (long) chunk * subsets * (long) sizeof(uint32_t);
+}
+
+// Under a budget, no buffer is kept larger than this input needs
+void trim_buffers()
+{
+	if (match_prev_capacity > index_src)
+	{
+		free(match_prev);
+		match_prev = NULL;
+		match_prev_capacity = 0;
+	}
+	// Grown again after the parse, to the path's length
+	free(tokens);
+	tokens = NULL;
+	tokens_capacity = 0;
+	// Allocated again by reserve_optimals() when the plan keeps it
+	free(optimals_table);
+	optimals_table = NULL;
+	optimals_table_capacity = 0;
+	optimals = NULL;
+}
+
+// Chooses the layout of this encode. FALSE when even the smallest one is over
+// budget.
+int plan_memory()
+{
+	int n = index_src;
+	int subsets = subset_high - subset_low + 1;
+	int chunk;
+
+	memory_layout = (bLOWMEM ? MEMORY_RING : MEMORY_FULL);
+	memory_threads = 1;
+	memory_chunk = 0;
+#ifndef __EMSCRIPTEN__
+	if (nThreads > 1 && n >= 2 * SEGMENT_MIN)
+	{
+		memory_threads = n / SEGMENT_MIN;
+		if (memory_threads > nThreads) memory_threads = nThreads;
+		if (memory_threads > SEGMENT_NBR) memory_threads = SEGMENT_NBR;
+	}
+	// A table per segment, each over its own range (see segment_bounds)
+	while (max_memory > 0 && memory_threads > 1
+		&& memory_floor(n) + segment_tables(n, memory_threads) > max_memory) memory_threads--;
+#endif
+	if (max_memory <= 0 || memory_threads > 1) return TRUE;
+	if (!bLOWMEM && memory_full(n) <= max_memory) return TRUE;
+	memory_layout = MEMORY_RING;
+	if (memory_floor(n) + (long) n * subsets * (long) sizeof(uint32_t) <= max_memory) return TRUE;
+	memory_layout = MEMORY_CHUNKED;
+	for (;;)
+	{
+		// Fewer checkpoints against shorter chunks: the smallest sum
+		for (chunk = OPTIMALS_RING; chunk < n && memory_chunked(n, subsets, 2 * chunk) < memory_chunked(n, subsets, chunk); chunk *= 2);
+		if (memory_chunked(n, subsets, chunk) <= max_memory) break;
+		if (subset_high == subset_low)
+		{
+			if (VERBOSE) printf("C: plan_memory: %ld bytes needed, %d allowed\n", memory_chunked(n, subsets, chunk), max_memory);
+			memory_needed = memory_chunked(n, subsets, chunk);
+			return FALSE;
+		}
+		subset_high--; // Window cap: give up the longest offsets
+		subsets--;
+	}
+	memory_chunk = chunk;
+	if (VERBOSE) printf("C: plan_memory: layout %d, %d threads, chunks of %d, subsets %d..%d\n", memory_layout, memory_threads, memory_chunk, subset_low, subset_high);
+	return TRUE;
+}
+
+int lzss_scan(int i, int end, int prev_match_index);
+
+// Chunked back-pointers: scans the chunk holding position i again
+void load_chunk(int chunk, int subset)
+{
+	int start = chunk * memory_chunk;
+	int end = start + memory_chunk;
+
+	memcpy(optimals_ring, checkpoints[chunk].ring, sizeof(optimals_ring));
+	back_pointer_first = (start > 0 ? start : 1);
+	lzss_scan(back_pointer_first, (end < index_src ? end : index_src), checkpoints[chunk].prev_match_index);
+	set_BIT_OFFSET3(subset); // The tokens are priced with the chosen subset
+}
+
+/*
+ * - WALK THE CHOSEN PATH INTO THE TOKENS -
+ * FALSE when the tokens do not fit (extra: as in note_memory).
+ */
+int build_tokens(int subset, long extra)
+{
+	uint32_t back_pointer;
+	int i, len, offset, room;
+
+	token_count = 0;
+	if (optimals_mask == -1)
+	{
+		if (!reserve_tokens(count_path(optimals, index_src - 1, 0, subset) + 1, extra)) return FALSE;
+		push_path(optimals, index_src - 1, 0, subset);
+	}
+	else
+	{
+		// Low memory mode: the costs are gone, price each token again. The
+		// path is only known chunk by chunk, so the tokens grow with it.
+		for (i = index_src - 1; i > 0; i -= len)
+		{
+			if (token_count + 1 >= tokens_capacity)
+			{
+				room = (tokens_capacity > 0 ? tokens_capacity + tokens_capacity / 2 + TOKENS_STEP : token_reserve(index_src));
+				if (room > index_src + 1) room = index_src + 1;
+				if (!reserve_tokens(room, extra) && !reserve_tokens(token_count + TOKENS_STEP, extra)
+					&& !reserve_tokens(token_count + 2, extra))
+				{
+					release_ring();
+					return FALSE;
+				}
+			}
+			if (i < back_pointer_first) load_chunk(i / memory_chunk, subset);
+			back_pointer = back_pointers[(size_t) (i - back_pointer_first) * (subset_high - subset_low + 1) + subset - subset_low];
+			len = back_pointer & 511;
+			offset = back_pointer >> 9;
+			tokens[token_count].len = len;
+			tokens[token_count].offset = offset;
+			tokens[token_count].bits = (offset != 0 ? count_bits(offset, len) : (len == 1 ? 1 + 8 : 1 + BIT_GOLOMG_MAX + 1 + 8 + len * 8));
+			token_count++;
+		}
+		release_ring();
+		if (!reserve_tokens(token_count + 1, extra)) return FALSE;
+	}
+	finish_tokens();
+	note_memory(extra);
+    if (VERBOSE) printf("C: build_tokens: %d tokens for subset %d\n", token_count, subset);
+	return TRUE;
+}
+
+/*
+ * - OPTIMAL PARSE, STEP BY STEP -
+ * lzss_slow is lzss_prepare, lzss_init, lzss_scan over every position and
+ * lzss_finish. The resumable encoder (dan3_encode_step) runs lzss_scan in
+ * slices between the two.
+ */
+// FALSE when out of memory or over max_memory
+int lzss_prepare()
+{
+    // Reset internal state for a fresh compression run
+	int i;
+    memory_peak = 0;
+    memory_needed = 0;
+    token_estimate = -1; // Set by prune_subsets()
+    if (max_memory > 0) {
+        trim_buffers();
+        if (memory_floor(index_src) > max_memory) {
+            if (VERBOSE) printf("C: lzss_prepare: %ld bytes needed at least, %d allowed\n", memory_floor(index_src), max_memory);
+            memory_needed = memory_floor(index_src);
+            return FALSE;
+        }
+    }
+    if (!grow_buffer((void **) &match_prev, &match_prev_capacity, index_src, sizeof(int))) return FALSE;
+    optimals = optimals_table;
+    optimals_mask = -1;
+    clear_matches();
+    for (i = 1; i < index_src; i++) insert_match(i);
+    prune_subsets();
+    note_memory(0);
+    return plan_memory();
+}
+
+// The full cost table, unless low memory mode rolls through optimals_ring
+int reserve_optimals()
+{
+    if (!grow_buffer((void **) &optimals_table, &optimals_table_capacity, index_src, sizeof(struct t_optimal))) return FALSE;
+    optimals = optimals_table;
+    return TRUE;
+}
+
+// Returns 1 when ready, 0 when there is nothing to compress, -1 when out of
+// memory
+int lzss_init()
+{
+    int size = index_src; // Positions past the input are never read
+    if (memory_layout != MEMORY_FULL && index_src > 0) {
+        release_ring();
+        back_pointers_count = (memory_layout == MEMORY_CHUNKED ? memory_chunk : index_src) * (subset_high - subset_low + 1);
+        back_pointers = (uint32_t *) malloc(sizeof(uint32_t) * back_pointers_count);
+        if (memory_layout == MEMORY_CHUNKED) {
+            checkpoint_count = (index_src + memory_chunk - 1) / memory_chunk;
+            checkpoints = (struct t_checkpoint *) malloc(sizeof(struct t_checkpoint) * checkpoint_count);
+        }
+        if (back_pointers != NULL && (memory_layout != MEMORY_CHUNKED || checkpoints != NULL)) {
+            optimals = optimals_ring;
+            optimals_mask = OPTIMALS_RING - 1;
+            size = OPTIMALS_RING;
+            back_pointer_first = (memory_layout == MEMORY_CHUNKED ? index_src : 0); // Chunks: none during the scan
+        }
+        else {
+            release_ring();
+            if (max_memory > 0) return -1;
+            if (VERBOSE) printf("C: lzss_init: no memory for the back-pointers, using the full table.\n");
+        }
+    }
+    if (optimals_mask == -1 && index_src > 0 && !reserve_optimals()) return -1;
+    note_memory(0);
+    // Initialize optimals table with a very large value (effectively Infinity)
+    if (VERBOSE) printf("C: lzss_slow: Initializing optimals table (%d entries)...\n", size);
+    for(int x = 0; x < size; x++) {
+        for(int y = 0; y < BIT_OFFSET_NBR; y++) {
+            optimals[x].bits[y] = 0x7FFFFFFF; // Max signed 32-bit int, acts as Infinity
+            optimals[x].offset[y] = 0;
+            optimals[x].len[y] = 0;
+        }
+        optimals[x].potential = BOUND_UNKNOWN;
+    }
+    // Initialize the first byte
+    if (index_src > 0) {
+        update_optimal(0, 1, 0);
+        OPTIMAL(0).potential = 0;
+        if (back_pointers != NULL && back_pointer_first == 0) save_back_pointers(0);
+        if (checkpoints != NULL) save_checkpoint(0, -1);
+        return 1;
+    }
+    if (VERBOSE) printf("C: lzss_slow: index_src is 0, nothing to compress.\n");
+    return 0;
+}
+
+// Scans positions i..end-1 and returns the prefix key to resume with
+int lzss_scan(int i, int end, int prev_match_index)
+{
+	while (i < end)
+	{
+		if (VERBOSE && (i % 1000 == 0 || i == index_src - 1)) {
+            printf("C: lzss_slow: Scan progress %d/%d bytes\n", i + 1, index_src);
+        }
+		if (optimals_mask != -1)
+		{
+			// Chunked back-pointers: the first scan saves the ring at each chunk
+			if (checkpoints != NULL && i < back_pointer_first && i % memory_chunk == 0) save_checkpoint(i / memory_chunk, prev_match_index);
+			clear_optimal(i); // Ring slot of position i - OPTIMALS_RING
+		}
+		prev_match_index = scan_position(i, prev_match_index);
+		if (back_pointers != NULL && i >= back_pointer_first) save_back_pointers(i);
+		i++;
+	}
+    if (VERBOSE && end == index_src) printf("C: lzss_slow: Scan done.\n");
+	return prev_match_index;
+}
+
+int lzss_finish()
+{
+	int i, j;
+	int bits_minimum_temp, bits_minimum;
+	int compressed_size;
+
+    // Select the best subset
+    if (index_src <= 0) { // Handle empty input gracefully after scan
+        if (VERBOSE) printf("C: lzss_slow: Empty input after scan, returning 0.\n");
+        return 0; // Return 0 length if input is empty
+    }
+
+	bits_minimum = OPTIMAL(index_src-1).bits[0];
+    if (OPTIMAL(index_src-1).bits[0] == 0x7FFFFFFF) {
+        if (VERBOSE) printf("C: lzss_slow: Subset 0 is unreachable at end. Trying others.\n");
+    }
+
+	j = 0; // j will hold the index of the best subset based on bits_minimum
+	for (i = 0;i < BIT_OFFSET_NBR_ALLOWED;i++)
+	{
+		bits_minimum_temp = OPTIMAL(index_src-1).bits[i];
+        if (bits_minimum_temp == 0x7FFFFFFF) { // If this subset is unreachable
+            if (VERBOSE) printf("C: lzss_slow: Subset %d is unreachable.\n", i);
+            continue;
+        }
+        if (VERBOSE) printf("C: lzss_slow: Subset %d (%d bits) cost: %d\n", i, BIT_OFFSET_MIN + i, bits_minimum_temp);
+
+		if (bits_minimum_temp < bits_minimum)
+		{
+			bits_minimum = bits_minimum_temp;
+			j = i;
+		}
+	}
+    if (VERBOSE) printf("C: lzss_slow: Best subset chosen: %d (offset_bits: %d) with %d bits.\n", j, BIT_OFFSET_MIN + j, bits_minimum);
+
+    if (bits_minimum == 0x7FFFFFFF) { // If even the "best" subset is unreachable
+        if (VERBOSE) printf("C: ERROR: lzss_slow: All subsets unreachable. Cannot compress.\n");
+        return -1; // Indicate failure
+    }
+
+    // The DP cost is exact: header + costs + end marker gives the output size,
+    // so the output capacity is validated once here instead of on every byte
+    compressed_size = (j + 1 + bits_minimum + 1 + BIT_GOLOMG_MAX + 1 + 7) / 8 + STREAM_FRAME;
+    if (bPREDICT) {
+        if (optimals_mask != -1) release_ring();
+        return compressed_size; // Size only: no path walk, no output
+    }
+    // Split streams can be a byte under this: write_split checks the exact size
+    if (!bSPLIT && compressed_size > size_dest) {
+        if (VERBOSE) printf("C: ERROR: lzss_slow: %d bytes of output do not fit in %d bytes.\n", compressed_size, size_dest);
+        return -1;
+    }
+
+	set_BIT_OFFSET3(j); // Set globals based on the chosen optimal subset
+	if (!build_tokens(j, 0)) return -1; // Walk the chosen path into the token list
+	return write_lz(j); // Write the compressed data and return its size
+}
+
+int lzss_deadline();
+extern DAN3_TLS int effort_region_count;
+
+// The serial parse, once lzss_prepare is done
+int lzss_parse()
+{
+    int i = lzss_init();
+    if (i <= 0) return i; // 0 length if input is empty, -1 out of memory
+    lzss_scan(1, index_src, -1);
+    return lzss_finish();
+}
+
+int lzss_slow()
+{
+    if (VERBOSE) printf("C: lzss_slow START. index_src: %d, bRLE: %d, bFAST: %d\n", index_src, bRLE, bFAST);
+    effort_region_count = 0;
+    if (deadline_ms > 0) return lzss_deadline();
+    if (!lzss_prepare()) return -1;
+#ifndef __EMSCRIPTEN__
+    if (memory_threads > 1) return lzss_segmented();
+#endif
+    return lzss_parse();
+}
+
+/*
+ * - AUTO-TUNE -
+ * Finds the options giving the smallest stream while building the match
+ * chains once. max_bits needs no parse of its own: the DP carries one cost per
+ * offset size, so a single parse prices every max_bits at once. That covers
+ * the offset sizes prune_subsets keeps (subset_low..subset_high); the pruned
+ * ones are not tried unless bPRUNE is off (-a). RLE and FAST change the
+ * candidates, so each of their combinations gets its own parse over the
+ * shared chains. With nThreads > 1 the others run on threads of their own
+ * while the default one runs on the calling thread. The winning table is then
+ * walked and written as usual.
+ */
+#define VARIANTS	4 /* bit 0: RLE off, bit 1: FAST */
+
+void set_dan3_options(int max_bits, int rle_enabled, int fast_mode);
+
+struct t_variant
+{
+	int rle;
+	int fast;
+	struct t_optimal *table;
+	int bits[BIT_OFFSET_NBR]; /* final cost per subset */
+#ifndef __EMSCRIPTEN__
+	struct t_parse_state state; /* of the calling thread */
+	pthread_t thread;
+#endif
+};
+
+void *parse_variant(void *arg)
+{
+	struct t_variant *variant = (struct t_variant *) arg;
+	int i, x, y;
+	int prev_match_index = -1;
+
+#ifndef __EMSCRIPTEN__
+	load_parse_state(&variant->state);
+#endif
+	optimals = variant->table;
+	optimals_mask = -1;
+	bRLE = variant->rle;
+	bFAST = variant->fast;
+	for (x = 0; x < index_src; x++)
+	{
+		for (y = 0; y < BIT_OFFSET_NBR; y++)
+		{
+			optimals[x].bits[y] = 0x7FFFFFFF;
+			optimals[x].offset[y] = 0;
+			optimals[x].len[y] = 0;
+		}
+		optimals[x].potential = BOUND_UNKNOWN;
+	}
+	update_optimal(0, 1, 0);
+	optimals[0].potential = 0;
+	for (i = 1; i < index_src; i++)
+	{
+		prev_match_index = scan_position(i, prev_match_index);
+	}
+	for (y = 0; y < BIT_OFFSET_NBR; y++) variant->bits[y] = optimals[index_src - 1].bits[y];
+	return NULL;
+}
+
+int lzss_autotune()
+{
+	struct t_variant variants[VARIANTS];
+	int rle = bRLE, fast = bFAST, max_bits = BIT_OFFSET_MAX_ALLOWED;
+	int i, k, size;
+	int best = 0, best_subset = 0, best_size = 0x7FFFFFFF;
+	int result = -1;
+	int current = -1; /* variant whose costs optimals_table holds */
+	long tables = 0; /* variant tables besides optimals_table */
+
+	if (index_src <= 0) return 0;
+	if (max_memory > 0 && memory_full(index_src) > max_memory)
+	{
+		if (VERBOSE) printf("C: lzss_autotune: no full table within max_memory, plain encode\n");
+		return lzss_slow();
+	}
+	BIT_OFFSET_MAX_ALLOWED = BIT_OFFSET_MAX;
+	BIT_OFFSET_NBR_ALLOWED = BIT_OFFSET_NBR;
+	if (!lzss_prepare() || !reserve_optimals())
+	{
+		set_dan3_options(max_bits, rle, fast);
+		return -1;
+	}
+	for (k = 0; k < VARIANTS; k++)
+	{
+		variants[k].rle = (k & 1 ? FALSE : TRUE);
+		variants[k].fast = (k & 2 ? TRUE : FALSE);
+		variants[k].table = optimals_table;
+#ifndef __EMSCRIPTEN__
+		save_parse_state(&variants[k].state);
+#endif
+	}
+#ifndef __EMSCRIPTEN__
+	if (nThreads > 1 && (max_memory <= 0 || memory_full(index_src) + (long) (VARIANTS - 1) * index_src * (long) sizeof(struct t_optimal) <= max_memory))
+	{
+		// One table per variant, the default one stays in optimals_table
+		for (k = 1; k < VARIANTS; k++)
+		{
+			variants[k].table = (struct t_optimal *) malloc(sizeof(struct t_optimal) * index_src);
+			if (variants[k].table == NULL || pthread_create(&variants[k].thread, NULL, parse_variant, &variants[k]) != 0)
+			{
+				if (VERBOSE) printf("C: lzss_autotune: variant %d parsed after the others\n", k);
+				free(variants[k].table);
+				variants[k].table = optimals_table;
+			}
+		}
+		// The default variant meanwhile, in optimals_table
+		parse_variant(&variants[0]);
+		current = 0;
+		for (k = 1; k < VARIANTS; k++)
+		{
+			if (variants[k].table == optimals_table) continue;
+			pthread_join(variants[k].thread, NULL);
+			tables += (long) sizeof(struct t_optimal) * index_src;
+		}
+	}
+#endif
+	note_memory(tables);
+	// Variants sharing optimals_table run one after the other, default last
+	for (k = VARIANTS - 1, i = (current == 0 ? 1 : 0); k >= i; k--)
+	{
+		if (variants[k].table != optimals_table) continue;
+		parse_variant(&variants[k]);
+		current = k;
+	}
+	bRLE = rle;
+	bFAST = fast;
+
+	// Smallest output, ties to the default options and the shortest offsets
+	for (k = 0; k < VARIANTS; k++)
+	{
+		for (i = 0; i < BIT_OFFSET_NBR; i++)
+		{
+			if (variants[k].bits[i] == 0x7FFFFFFF) continue;
+			size = (i + 1 + variants[k].bits[i] + 1 + BIT_GOLOMG_MAX + 1 + 7) / 8 + STREAM_FRAME;
+			if (VERBOSE) printf("C: lzss_autotune: rle %d fast %d max_bits %d: %d bytes\n", variants[k].rle, variants[k].fast, BIT_OFFSET_MIN + i, size);
+			if (size < best_size)
+			{
+				best_size = size;
+				best = k;
+				best_subset = i;
+			}
+		}
+	}
+	if (best_size == 0x7FFFFFFF || (!bSPLIT && best_size > size_dest))
+	{
+		if (VERBOSE) printf("C: ERROR: lzss_autotune: no variant fits in %d bytes.\n", size_dest);
+		set_dan3_options(max_bits, rle, fast);
+		goto done;
+	}
+	// The winner parsed in optimals_table may have been overwritten since
+	if (variants[best].table == optimals_table && best != current) parse_variant(&variants[best]);
+	set_dan3_options(BIT_OFFSET_MIN + best_subset, variants[best].rle, variants[best].fast);
+	if (VERBOSE) printf("C: lzss_autotune: chose rle %d fast %d max_bits %d (%d bytes)\n", bRLE, bFAST, BIT_OFFSET_MAX_ALLOWED, best_size);
+
+	optimals = variants[best].table;
+	set_BIT_OFFSET3(best_subset);
+	if (build_tokens(best_subset, tables)) result = write_lz(best_subset);
+	optimals = optimals_table;
+
+done:
+	for (k = 1; k < VARIANTS; k++)
+	{
+		if (variants[k].table != optimals_table) free(variants[k].table);
+	}
+	return result;
+}
+
+/*
+ * - TIME BUDGET -
+ * With deadline_ms set, the encode aims to finish within that many
+ * milliseconds. The input is scanned DEADLINE_STEP bytes at a time. After each
+ * step the pace of the current level, applied to the rest of the input, is
+ * checked against the time left; when the rest would not fit, the next steps
+ * get one effort level less:
+ *   EFFORT_FULL     the optimal parse
+ *   EFFORT_SHALLOW  DEADLINE_DEPTH chain entries per position at most
+ *   EFFORT_NARROW   and only the subset leading so far
+ *   EFFORT_GREEDY   longest match or a literal, to the end of the input
+ * Every level prices its tokens in the same table, so the path is walked and
+ * written as usual into a plain DAN3 stream. effort_regions keeps the lowest
+ * level each DEADLINE_REGION bytes got. The budget is for one encode, always
+ * parsed on one thread in the full table (no -t, no -l). Table setup and the
+ * greedy pass always run to the end, so a budget below their time is missed.
+ */
+#define EFFORT_FULL		0
+#define EFFORT_SHALLOW	1
+#define EFFORT_NARROW	2
+#define EFFORT_GREEDY	3
+#define DEADLINE_REGION	1024
+#define DEADLINE_STEP	64
+#define DEADLINE_DEPTH	8
+#define DEADLINE_RESERVE	10 /* percent of the budget left for the path walk and the output */
+#define DEADLINE_PRUNE	4 /* the subset estimate gets 1/DEADLINE_PRUNE of the budget */
+
+DAN3_TLS unsigned char effort_regions[(MAX) / DEADLINE_REGION + 1];
+DAN3_TLS int effort_region_count = 0;
+
+// Keeps the subset with the lowest cost at position i, drops the others
+void narrow_subsets(int i)
+{
+	int y, best = subset_low;
+	for (y = subset_low + 1; y <= subset_high; y++)
+	{
+		if (OPTIMAL(i).bits[y] < OPTIMAL(i).bits[best]) best = y;
+	}
+	subset_low = subset_high = best;
+	set_BIT_OFFSET3(best);
+}
+
+// One greedy token starting at position i: the longest match among the
+// closest offsets (the chain of i+1 holds the pairs equal to i, i+1), or a
+// literal when no match is cheaper. Returns the position after the token.
+int greedy_token(int i)
+{
+	int best_len = 1, best_offset = 0;
+	int len, offset, match, depth = 0;
+	int k;
+
+	if (i + 1 < index_src)
+	{
+		for (match = match_prev[i+1]; match >= 0; match = match_prev[match])
+		{
+			offset = i + 1 - match;
+			if (offset > MAX_OFFSET3 || ++depth > DEADLINE_DEPTH) break;
+			for (len = 2; len < (MAX_GAMMA) && i + len < index_src && ptr_src[i+len] == ptr_src[i+len-offset]; len++);
+			if (len > best_len)
+			{
+				best_len = len;
+				best_offset = offset;
+			}
+		}
+	}
+	if (best_len > 1 && count_bits(best_offset, best_len) < best_len * (1 + 8))
+	{
+		update_optimal(i + best_len - 1, best_len, best_offset);
+		return i + best_len;
+	}
+	update_optimal(i, 1, 0);
+	for (k = 1; k <= (MAX_OFFSET0) && k <= i; k++)
+	{
+		if (ptr_src[i] == ptr_src[i-k]) update_optimal(i, 1, k);
+	}
+	return i + 1;
+}
+
+int lzss_deadline()
+{
+	double start = now_ms();
+	double budget = deadline_ms * (100 - DEADLINE_RESERVE) / 100.0;
+	double level_start, left;
+	int lowmem = bLOWMEM;
+	int effort = EFFORT_FULL, level;
+	int level_pos = 1; /* first position at this effort level */
+	int prev_match_index = -1;
+	int i, end;
+
+	effort_region_count = (index_src + DEADLINE_REGION - 1) / DEADLINE_REGION;
+	memset(effort_regions, EFFORT_FULL, effort_region_count);
+	prune_stop_ms = start + deadline_ms / (double) DEADLINE_PRUNE;
+	bLOWMEM = FALSE; // The levels change the subsets mid-scan, the back-pointers could not follow
+	i = lzss_prepare();
+	bLOWMEM = lowmem;
+	prune_stop_ms = 0;
+	if (!i) return -1;
+	if (memory_layout != MEMORY_FULL) return lzss_parse(); // No full table within max_memory: no levels
+	i = lzss_init();
+	if (i <= 0) return i; // 0 length if input is empty, -1 out of memory
+
+	chain_depth = 0;
+	level_start = now_ms();
+	for (i = 1; i < index_src && effort < EFFORT_GREEDY; i = end)
+	{
+		end = (i + DEADLINE_STEP < index_src ? i + DEADLINE_STEP : index_src);
+		if (effort_regions[i / DEADLINE_REGION] < effort) effort_regions[i / DEADLINE_REGION] = effort;
+		prev_match_index = lzss_scan(i, end, prev_match_index);
+
+		// Pace of this level so far over the rest of the input, against the time left
+		level = effort;
+		left = budget - (now_ms() - start);
+		if (left <= 0) effort = EFFORT_GREEDY;
+		else if (end < index_src && (now_ms() - level_start) * (index_src - end) / (end - level_pos) > left) effort++;
+		if (effort == level) continue;
+		if (VERBOSE) printf("C: lzss_deadline: effort %d from %d after %.1f ms\n", effort, end, now_ms() - start);
+		if (effort >= EFFORT_SHALLOW) chain_depth = DEADLINE_DEPTH;
+		if (effort >= EFFORT_NARROW && subset_low != subset_high) narrow_subsets(end - 1);
+		level_start = now_ms();
+		level_pos = end;
+	}
+	if (i < index_src)
+	{
+		for (end = i / DEADLINE_REGION; end < effort_region_count; end++) effort_regions[end] = EFFORT_GREEDY;
+		while (i < index_src) i = greedy_token(i);
+	}
+	chain_depth = 0;
+	if (VERBOSE) printf("C: lzss_deadline: parsed in %.1f ms of %d\n", now_ms() - start, deadline_ms);
+	return lzss_finish();
+}
+
+/* 
+ * KEY CHANGES MADE:
+ * 
+ * 1. CRITICAL FIX: Moved the bounds checking BEFORE the update_optimal() call in the LZ MATCH OF 2+ section
+ * 2. Added proper bounds checking for the fast path optimization case
+ * 3. Changed the bounds check behavior from abort() to break, allowing the algorithm to continue with shorter lengths
+ * 4. Added more defensive programming for edge cases
+ * 
+ * The main issue was that update_optimal() was being called with potentially invalid parameters,
+ * and it would try to access the optimals array with out-of-bounds indices before the bounds check
+ * could catch the problem. Now the bounds are verified first, making the code much safer.
+ */
+
+/*
+ * - DECOMPRESSION LOGIC - (Core decompression logic)
+ */
+// Position of the compressed data inside ptr_dest when decoding in place (-1 otherwise)
+DAN3_TLS int inplace_base = -1;
+
+// Trailer at index_src, after the end marker
+uint32_t read_crc_trailer()
+{
+	uint32_t crc = 0;
+	int i;
+	for (i = 0; i < CRC_TRAILER; i++) crc |= (uint32_t) read_byte() << (8 * i);
+	return crc;
+}
+
+int delzss()
+{
+    if (VERBOSE) printf("C: delzss START. index_src (compressed_len): %d\n", index_src);
+	int	subset = 0;
+	int old_index_src = index_src; // Total length of compressed input
+	int len, offset;
+	int i;
+	int crc_done = 0;
+	uint32_t crc = 0;
+
+	// Reset bit counters for reading
+	index_src = 0; // Reset index_src to start of compressed data
+	bit_mask = 0;
+	bit_index = 0;
+
+	// Read subset header
+    if (old_index_src <= 0) {
+        if (VERBOSE) printf("C: delzss: Empty compressed input.\n");
+        return (crc_check ? -1 : 0); // A CRC-32 header promises a stream and its trailer
+    }
+    if (index_src >= old_index_src) { // Check if we ran out of input after header
+        if (VERBOSE) printf("C: delzss: Compressed input too short to read header.\n");
+        return -1; // Error
+    }
+    if (VERBOSE) printf("C: delzss: Reading subset header (index_src: %d, old_index_src: %d)...\n", index_src, old_index_src);
+	while (read_bit() != 0)
+	{
+		subset++;
+        if (subset > BIT_OFFSET_NBR || (bit_mask == 0 && index_src >= old_index_src)) { // Prevent infinite loop or OOB read
+            if (VERBOSE) printf("C: ERROR: delzss: Subset header read too long or OOB!\n");
+            return -1;
+        }
+	}
+    if (VERBOSE) printf("C: delzss: Selected subset %d (offset_bits %d).\n", subset, subset + BIT_OFFSET_MIN);
+
+	// First byte raw
+	index_dest = 0; // Reset index_dest for writing decompressed data
+    if (index_src >= old_index_src) { // Check if we ran out of input after header
+        if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short after subset header to read first byte.\n");
+        return -1;
+    }
+    unsigned char first_byte = read_byte();
+	write_byte(first_byte);
+    if (VERBOSE) printf("C: delzss: Wrote first byte: 0x%02X at index_dest %d\n", first_byte, index_dest - 1);
+
+
+	while (index_src < old_index_src) // Loop until end of compressed input
+	{
+        if (VERBOSE && index_dest % 1000 == 0) {
+            printf("C: delzss: Decompression progress: %d bytes decompressed\n", index_dest);
+        }
+        if (index_src >= old_index_src) { // Check for read_bit, read_byte from OOB
+            if (VERBOSE) printf("C: delzss: End of compressed data reached unexpectedly.\n");
+            break;
+        }
+        if (inplace_base >= 0 && index_dest > inplace_base + (bit_mask != 0 ? bit_index : index_src)) {
+            if (VERBOSE) printf("C: ERROR: delzss: In-place output (%d) overran unread input (%d). Margin too small.\n", index_dest, inplace_base + (bit_mask != 0 ? bit_index : index_src));
+            return -1;
+        }
+		if (crc_check && index_dest - crc_done >= CRC_BLOCK)
+		{
+			crc = crc32_update(crc, ptr_dest + crc_done, index_dest - crc_done);
+			crc_done = index_dest;
+		}
+		if (read_bit()) // Is next byte literal or match (1=literal, 0=match/RLE/End)
+		{
+			/* LITERAL */
+            if (index_src >= old_index_src) {
+                if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for literal byte.\n");
+                return -1;
+            }
+            if (index_dest >= size_dest) {
+                if (VERBOSE) printf("C: ERROR: delzss: Output buffer full (%d bytes) at literal.\n", size_dest);
+                return -1;
+            }
+            unsigned char lit_byte = read_byte();
+			write_byte(lit_byte);
+            if (VERBOSE) printf("C: delzss: Decompressed literal byte 0x%02X at index_dest %d\n", lit_byte, index_dest - 1);
+		}
+		else // Match, RLE, or End marker
+		{
+			len = read_golomb_gamma(old_index_src);
+            if (VERBOSE) printf("C: delzss: Read golomb gamma len: %d\n", len);
+            if (len == -2) {
+                if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for golomb gamma length.\n");
+                return -1;
+            }
+			if (len == -1) // Special code / End marker
+			{
+                if (bit_mask == 0 && index_src >= old_index_src) {
+                    if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for end/RLE flag.\n");
+                    return -1;
+                }
+				if (read_bit() == 0) // End marker (0 0s, then 0)
+				{
+                    if (VERBOSE) printf("C: delzss: End marker reached.\n");
+					break; // EOF
+				}
+				else // RLE (0 0s, then 1)
+				{
+                    if (index_src >= old_index_src) {
+                        if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for RLE length byte.\n");
+                        return -1;
+                    }
+					len = read_byte() + 1; // Actual RLE length
+                    if (index_dest + len > size_dest) {
+                        if (VERBOSE) printf("C: ERROR: delzss: RLE of %d bytes overflows output buffer (%d bytes).\n", len, size_dest);
+                        return -1;
+                    }
+                    if (VERBOSE) printf("C: delzss: Decompressing RLE of length %d\n", len);
+                    if (index_src + len > old_index_src) {
+                        if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for RLE data (%d bytes left, %d needed).\n", old_index_src - index_src, len);
+                        return -1;
+                    }
+					copy_forward(ptr_dest + index_dest, ptr_src + index_src, len);
+					index_src += len;
+					index_dest += len;
+				}
+			}
+			else // Match
+			{
+				offset = 0;
+                if (VERBOSE) printf("C: delzss: Decoding match (len=%d)...\n", len);
+
+				if (len == 1) // Match length 1
+				{
+                    if (bit_mask == 0 && index_src >= old_index_src) {
+                        if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for match offset bit (len=1).\n");
+                        return -1;
+                    }
+					if (read_bit()) // Read 1 bit for short offset
+					{
+                        if (bit_mask == 0 && index_src >= old_index_src) {
+                            if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for second match offset bit (len=1).\n");
+                            return -1;
+                        }
+						offset = read_bit() + 1;
+					} else {
+                        offset = 0; // If len is 1 and first offset bit is 0, offset is 0. This seems unusual for LZSS matches.
+                    }
+                    if (VERBOSE) printf("C: delzss: Match (len=1) offset: %d\n", offset);
+				}
+				else // Match length > 1
+				{
+                    if (bit_mask == 0 && index_src >= old_index_src) {
+                        if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for match offset type bit (len>1).\n");
+                        return -1;
+                    }
+					if (!read_bit()) // Read 1 bit for offset type (0 = 8-bit offset, 1 = longer offset)
+					{
+						/* 8bit offset */
+                        if (index_src >= old_index_src) {
+                            if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for 8-bit offset byte.\n");
+                            return -1;
+                        }
+						offset = read_byte() + 32; // This '32' constant implies a specific offset base
+                        if (VERBOSE) printf("C: delzss: Match (len=%d) 8-bit offset: %d\n", len, offset);
+					}
+					else // Longer offset encoding (first bit was 1)
+					{
+                        if (bit_mask == 0 && index_src >= old_index_src) {
+                            if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for long offset type bit.\n");
+                            return -1;
+                        }
+						if (read_bit()) // If second bit is 1 (1 1 = very long offset)
+						{
+                            if (VERBOSE) printf("C: delzss: Match (len=%d) very long offset (subset=%d, BIT_OFFSET_MIN=%d)\n", len, subset, BIT_OFFSET_MIN);
+							for (i = 0;i < subset + BIT_OFFSET_MIN - 8;i++) // Read remaining bits for the full offset value
+							{
+                                if (bit_mask == 0 && index_src >= old_index_src) {
+                                    if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for long offset bit %d/%d.\n", i, subset + BIT_OFFSET_MIN - 8);
+                                    return -1;
+                                }
+								offset <<= 1;
+								offset |= read_bit();
+							}
+                            if (index_src >= old_index_src) {
+                                if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for long offset byte.\n");
+                                return -1;
+                            }
+							offset <<= 8; // Shift to make room for the byte
+							offset |= read_byte(); // Read the byte part
+							offset += 256 + 32; // Add base offset
+                            if (VERBOSE) printf("C: delzss: Match (len=%d) very long offset calculated: %d\n", len, offset);
+						}
+						else // If second bit is 0 (1 0 = 5-bit offset)
+						{
+							/* 5 bits offset */
+                            if (VERBOSE) printf("C: delzss: Match (len=%d) 5-bit offset...\n", len);
+							for (i = 0;i < 5;i++)
+							{
+                                if (bit_mask == 0 && index_src >= old_index_src) {
+                                    if (VERBOSE) printf("C: ERROR: delzss: Compressed input too short for 5-bit offset bit %d/5.\n", i);
+                                    return -1;
+                                }
+								offset <<= 1;
+								offset |= read_bit();
+							}
+                            if (VERBOSE) printf("C: delzss: Match (len=%d) 5-bit offset calculated: %d\n", len, offset);
+						}
+					}
+				}
+				// Perform the match copy
+                if (VERBOSE) printf("C: delzss: Copying match: src_start_dest_index=%d, len=%d, offset=%d\n", index_dest - offset - 1, len, offset);
+
+                int source_start_index = index_dest - offset - 1;
+                if (source_start_index < 0) { // Corrupt input: match reaches before the output start (overlapping copies are valid)
+                    if (VERBOSE) printf("C: ERROR: delzss: Match copy source bounds invalid! src_idx=%d, len=%d, current_dest=%d.\n", source_start_index, len, index_dest);
+                    return -1;
+                }
+                if (index_dest + len > size_dest) { // Corrupt input: match overflows the output buffer
+                    if (VERBOSE) printf("C: ERROR: delzss: Match copy dest bounds invalid! dest_idx=%d, len=%d, size_dest=%d.\n", index_dest, len, size_dest);
+                    return -1;
+                }
+
+				// ptr_dest[index_dest + i] = ptr_dest[index_dest + i - offset - 1]
+				copy_forward(ptr_dest + index_dest, ptr_dest + source_start_index, len);
+				index_dest += len;
+			}
+		}
+	}
+	if (crc_check)
+	{
+		crc = crc32_update(crc, ptr_dest + crc_done, index_dest - crc_done);
+		if (index_src + CRC_TRAILER > old_index_src || crc != read_crc_trailer())
+		{
+			if (VERBOSE) printf("C: ERROR: delzss: CRC-32 mismatch or missing trailer (computed 0x%08X).\n", crc);
+			return -1;
+		}
+	}
+    if (VERBOSE) printf("C: delzss END. Final index_dest: %d\n", index_dest);
+	return index_dest; // Return decompressed size
+}
+
+/*
+ * - STREAMING DECOMPRESSION -
+ * Same token walk as delzss(), but the decompressed data only lives in a ring
+ * buffer large enough for the farthest match offset. Bytes are pushed to a
+ * sink callback in chunks as soon as they are produced, so memory use does
+ * not depend on the output size.
+ */
+#define RING_SIZE	(1<<17) /* Power of two above MAX_OFFSET */
+#define RING_MASK	(RING_SIZE - 1)
+
+typedef void (*t_dan3_sink)(const uint8_t *data, int len, void *user);
+
+DAN3_TLS unsigned char ring_dest[RING_SIZE];
+DAN3_TLS t_dan3_sink stream_sink;
+DAN3_TLS void *stream_user;
+DAN3_TLS int stream_chunk;
+DAN3_TLS int stream_flushed; /* Bytes already handed to the sink */
+DAN3_TLS uint32_t stream_crc; /* of the bytes handed to the sink, when crc_check */
+
+void stream_out(const uint8_t *data, int len)
+{
+	if (crc_check) stream_crc = crc32_update(stream_crc, data, len);
+	stream_sink(data, len, stream_user);
+}
+
+void stream_flush()
+{
+	int start = stream_flushed & RING_MASK;
+	int len = index_dest - stream_flushed;
+	if (len <= 0) return;
+	if (start + len > RING_SIZE)
+	{
+		stream_out(ring_dest + start, RING_SIZE - start);
+		len -= RING_SIZE - start;
+		start = 0;
+	}
+	stream_out(ring_dest + start, len);
+	stream_flushed = index_dest;
+}
+
+void stream_byte(unsigned char value)
+{
+	ring_dest[index_dest & RING_MASK] = value;
+	index_dest++;
+	if (index_dest - stream_flushed >= stream_chunk) stream_flush();
+}
+
+// Decodes ptr_src[0..index_src) up to max_len bytes (max_len < 0: whole stream)
+int delzss_stream(int max_len)
+{
+    if (VERBOSE) printf("C: delzss_stream START. index_src (compressed_len): %d, max_len: %d, chunk: %d\n", index_src, max_len, stream_chunk);
+	int subset = 0;
+	int old_index_src = index_src;
+	int len, offset;
+	int i;
+	int end_marker = FALSE;
+
+	index_src = 0;
+	bit_mask = 0;
+	bit_index = 0;
+	index_dest = 0;
+	stream_flushed = 0;
+	stream_crc = 0;
+	if (max_len < 0) max_len = 0x7FFFFFFF;
+	if (old_index_src <= 0 || max_len == 0) return (crc_check && max_len != 0 ? -1 : 0);
+
+	while (read_bit() != 0)
+	{
+		subset++;
+		if (subset > BIT_OFFSET_NBR || (bit_mask == 0 && index_src >= old_index_src)) return -1;
+	}
+	if (index_src >= old_index_src) return -1;
+	stream_byte(read_byte());
+
+	while (index_dest < max_len && (bit_mask != 0 || index_src < old_index_src))
+	{
+		if (read_bit())
+		{
+			/* LITERAL */
+			if (index_src >= old_index_src) return -1;
+			stream_byte(read_byte());
+			continue;
+		}
+		len = read_golomb_gamma(old_index_src);
+		if (len == -2) return -1;
+		if (len == -1)
+		{
+			if (bit_mask == 0 && index_src >= old_index_src) return -1;
+			if (read_bit() == 0) /* END MARKER */
+			{
+				stream_flush();
+				// A stream cut short by max_len has nothing to check
+				if (crc_check && (index_src + CRC_TRAILER > old_index_src || stream_crc != read_crc_trailer()))
+				{
+					if (VERBOSE) printf("C: ERROR: delzss_stream: CRC-32 mismatch or missing trailer.\n");
+					return -1;
+				}
+				end_marker = TRUE;
+				break;
+			}
+			/* RLE */
+			if (index_src >= old_index_src) return -1;
+			len = read_byte() + 1;
+			if (index_src + len > old_index_src) return -1;
+			for (i = 0; i < len && index_dest < max_len; i++)
+			{
+				stream_byte(read_byte());
+			}
+			continue;
+		}
+		/* MATCH */
+		offset = 0;
+		if (bit_mask == 0 && index_src >= old_index_src) return -1;
+		if (len == 1)
+		{
+			if (read_bit())
+			{
+				if (bit_mask == 0 && index_src >= old_index_src) return -1;
+				offset = read_bit() + 1;
+			}
+		}
+		else if (!read_bit())
+		{
+			if (index_src >= old_index_src) return -1;
+			offset = read_byte() + 32;
+		}
+		else if (bit_mask == 0 && index_src >= old_index_src)
+		{
+			return -1;
+		}
+		else if (read_bit())
+		{
+			for (i = 0; i < subset + BIT_OFFSET_MIN - 8; i++)
+			{
+				if (bit_mask == 0 && index_src >= old_index_src) return -1;
+				offset <<= 1;
+				offset |= read_bit();
+			}
+			if (index_src >= old_index_src) return -1;
+			offset <<= 8;
+			offset |= read_byte();
+			offset += 256 + 32;
+		}
+		else
+		{
+			for (i = 0; i < 5; i++)
+			{
+				if (bit_mask == 0 && index_src >= old_index_src) return -1;
+				offset <<= 1;
+				offset |= read_bit();
+			}
+		}
+		if (index_dest - offset - 1 < 0)
+		{
+			if (VERBOSE) printf("C: ERROR: delzss_stream: Match source %d before start of data!\n", index_dest - offset - 1);
+			return -1;
+		}
+		for (i = 0; i < len && index_dest < max_len; i++)
+		{
+			stream_byte(ring_dest[(index_dest - offset - 1) & RING_MASK]);
+		}
+	}
+	if (crc_check && !end_marker && index_dest < max_len) // Input ran out before the trailer
+	{
+		if (VERBOSE) printf("C: ERROR: delzss_stream: No end marker, CRC-32 trailer missing.\n");
+		return -1;
+	}
+	stream_flush();
+    if (VERBOSE) printf("C: delzss_stream END. Bytes produced: %d\n", index_dest);
+	return index_dest;
+}
+
+/*
+ * - SPLIT STREAM DECODER - (see SPLIT STREAMS)
+ * Reads ptr_src[0..index_src), the stream after its 2-byte header. A bit
+ * register holds at least 32 bits after bits_refill: enough for any token's
+ * control bits (at most 12) or gamma (at most 15). Past its end a stream
+ * reads as 0 bits, which decode to an end marker; overruns are caught once
+ * the walk is over.
+ */
+struct t_bit_reader
+{
+	const uint8_t *next, *end;
+	uint64_t acc; /* next bits from the top, count of them valid */
+	int count;
+	int pad; /* 0 bits added past the end */
+};
+
+void bits_init(struct t_bit_reader *r, const uint8_t *data, int len)
+{
+	r->next = data;
+	r->end = data + len;
+	r->acc = 0;
+	r->count = 0;
+	r->pad = 0;
+}
+
+void bits_refill(struct t_bit_reader *r)
+{
+	uint64_t word;
+	int i;
+	if (r->count >= 32) return;
+	if (r->end - r->next >= 8)
+	{
+		// One big-endian load; the bits below count are rewritten identical next time
+		for (word = 0, i = 0; i < 8; i++) word = (word << 8) | r->next[i];
+		r->acc |= word >> r->count;
+		r->next += (63 - r->count) >> 3;
+		r->count |= 56;
+		return;
+	}
+	for (; r->count <= 56; r->count += 8)
+	{
+		if (r->next < r->end) r->acc |= (uint64_t) *r->next++ << (56 - r->count);
+		else r->pad += 8;
+	}
+}
+
+int bits_take(struct t_bit_reader *r, int n)
+{
+	int value = (int) (r->acc >> (64 - n));
+	r->acc <<= n;
+	r->count -= n;
+	return value;
+}
+
+// Bits read past the end of the stream
+int bits_overrun(struct t_bit_reader *r)
+{
+	return r->pad > r->count;
+}
+
+int delzss_split()
+{
+	struct t_bit_reader control, gamma;
+	const uint8_t *raw, *raw_end;
+	int control_len, gamma_len, raw_len;
+	int subset = 0, len, offset, j;
+	int crc_done = 0;
+	uint32_t crc = 0;
+
+	index_dest = 0;
+	if (index_src < SPLIT_LENGTHS || ptr_src[0] != 0xFF || (ptr_src[1] & 0x80) == 0) return -1;
+	control_len = ((ptr_src[1] << 16) | (ptr_src[2] << 8) | ptr_src[3]) & (SPLIT_MARK - 1);
+	gamma_len = (ptr_src[4] << 16) | (ptr_src[5] << 8) | ptr_src[6];
+	raw_len = index_src - SPLIT_LENGTHS - control_len - gamma_len - (crc_check ? CRC_TRAILER : 0);
+	if (raw_len < 1)
+	{
+		if (VERBOSE) printf("C: ERROR: delzss_split: stream lengths %d + %d do not fit in %d bytes.\n", control_len, gamma_len, index_src);
+		return -1;
+	}
+	bits_init(&control, ptr_src + SPLIT_LENGTHS, control_len);
+	bits_init(&gamma, ptr_src + SPLIT_LENGTHS + control_len, gamma_len);
+	raw = ptr_src + SPLIT_LENGTHS + control_len + gamma_len;
+	raw_end = raw + raw_len;
+
+	bits_refill(&control);
+	while (bits_take(&control, 1))
+	{
+		if (++subset > BIT_OFFSET_NBR) return -1;
+	}
+	ptr_dest[index_dest++] = *raw++;
+
+	for (;;)
+	{
+		bits_refill(&control);
+		if (control.acc >> 63)
+		{
+			// Literals: as many as there are leading 1s
+			len = (~control.acc == 0 ? 64 : __builtin_clzll(~control.acc));
+			if (len > control.count) len = control.count;
+			if (raw + len > raw_end || index_dest + len > size_dest) return -1;
+			bits_take(&control, len);
+			memcpy(ptr_dest + index_dest, raw, len);
+			raw += len;
+			index_dest += len;
+		}
+		else
+		{
+			bits_take(&control, 1);
+			bits_refill(&gamma);
+			if ((gamma.acc >> (64 - BIT_GOLOMG_MAX)) == 0)
+			{
+				bits_take(&gamma, BIT_GOLOMG_MAX);
+				if (!bits_take(&control, 1)) break; /* END MARKER */
+				/* RLE */
+				if (raw >= raw_end) return -1;
+				len = *raw++ + 1;
+				if (raw + len > raw_end || index_dest + len > size_dest) return -1;
+				memcpy(ptr_dest + index_dest, raw, len);
+				raw += len;
+				index_dest += len;
+			}
+			else
+			{
+				/* MATCH */
+				j = __builtin_clzll(gamma.acc);
+				len = bits_take(&gamma, 2 * j + 2) - 1;
+				if (len == 1)
+				{
+					offset = (bits_take(&control, 1) ? bits_take(&control, BIT_OFFSET0) + MAX_OFFSET00 : 0);
+				}
+				else if (!bits_take(&control, 1))
+				{
+					if (raw >= raw_end) return -1;
+					offset = *raw++ + MAX_OFFSET1;
+				}
+				else if (bits_take(&control, 1))
+				{
+					if (raw >= raw_end) return -1;
+					offset = (bits_take(&control, subset + BIT_OFFSET_MIN - BIT_OFFSET2) << 8 | *raw++) + MAX_OFFSET2;
+				}
+				else
+				{
+					offset = bits_take(&control, BIT_OFFSET1);
+				}
+				if (index_dest - offset - 1 < 0 || index_dest + len > size_dest)
+				{
+					if (VERBOSE) printf("C: ERROR: delzss_split: match of %d at offset %d out of bounds at %d.\n", len, offset, index_dest);
+					return -1;
+				}
+				copy_forward(ptr_dest + index_dest, ptr_dest + index_dest - offset - 1, len);
+				index_dest += len;
+			}
+		}
+		if (crc_check && index_dest - crc_done >= CRC_BLOCK)
+		{
+			crc = crc32_update(crc, ptr_dest + crc_done, index_dest - crc_done);
+			crc_done = index_dest;
+		}
+	}
+	if (bits_overrun(&control) || bits_overrun(&gamma) || raw != raw_end)
+	{
+		if (VERBOSE) printf("C: ERROR: delzss_split: streams do not end together.\n");
+		return -1;
+	}
+	if (crc_check)
+	{
+		crc = crc32_update(crc, ptr_dest + crc_done, index_dest - crc_done);
+		for (j = 0; j < CRC_TRAILER; j++) crc ^= (uint32_t) raw_end[j] << (8 * j);
+		if (crc != 0)
+		{
+			if (VERBOSE) printf("C: ERROR: delzss_split: CRC-32 mismatch.\n");
+			return -1;
+		}
+	}
+    if (VERBOSE) printf("C: delzss_split END. Final index_dest: %d\n", index_dest);
+	return index_dest;
+}
+
+/*
+ * - Z80 DECODE TIME ESTIMATE -
+ * Walks a stream like delzss() without writing anything and charges each
+ * step with the T-states the Z80 decompressor spends on it. The defaults
+ * follow the instruction timings of the reference ColecoVision/MSX routine
+ * (bit buffer in A, ldi/ldir copies); set_z80_cost() adjusts them for
+ * another routine or for wait states. Besides the total, one sum is kept
+ * per region of z80_region_size decoded bytes: a token is charged to the
+ * region its first byte lands in.
+ */
+#define Z80_BIT			0 /* read one bit from the bit buffer */
+#define Z80_REFILL		1 /* load the next byte into the bit buffer */
+#define Z80_BYTE		2 /* read one raw byte (offset, RLE length) */
+#define Z80_TOKEN		3 /* dispatch one token */
+#define Z80_LITERAL		4 /* copy one literal */
+#define Z80_RLE_BYTE	5 /* copy one byte of an RLE run */
+#define Z80_MATCH		6 /* compute the source of a match */
+#define Z80_MATCH_BYTE	7 /* copy one byte of a match */
+#define Z80_SETUP		8 /* entry, header and exit */
+#define Z80_COSTS		9
+
+#define Z80_REGION_MIN	64
+#define Z80_REGIONS		((MAX) / Z80_REGION_MIN + 1)
+
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int z80_costs[Z80_COSTS] = { 18, 25, 13, 10, 26, 21, 62, 21, 120 };
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int z80_region_size = 1024;
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int z80_region_cycles[Z80_REGIONS];
+EMSCRIPTEN_KEEPALIVE DAN3_TLS int z80_region_count;
+DAN3_TLS int z80_region; /* Region charged by the current token */
+
+void z80_charge(int event, int count)
+{
+	z80_region_cycles[z80_region] += z80_costs[event] * count;
+}
+
+// One bit, -1 when the stream ends before it
+int z80_bit(int end)
+{
+	if (bit_mask == 0)
+	{
+		if (index_src >= end) return -1;
+		z80_charge(Z80_REFILL, 1);
+	}
+	z80_charge(Z80_BIT, 1);
+	return read_bit();
+}
+
+// One raw byte, -1 when the stream ends before it
+int z80_byte(int end)
+{
+	if (index_src >= end) return -1;
+	z80_charge(Z80_BYTE, 1);
+	return read_byte();
+}
+
+// Same code as read_golomb_gamma(), -2 when the stream ends inside it
+int z80_gamma(int end)
+{
+	int value = 1;
+	int bit, i, j = 0;
+	while (j < BIT_GOLOMG_MAX && (bit = z80_bit(end)) == 0) j++;
+	if (j == BIT_GOLOMG_MAX) return -1;
+	if (bit < 0) return -2;
+	for (i = 0; i <= j; i++)
+	{
+		if ((bit = z80_bit(end)) < 0) return -2;
+		value = (value << 1) | bit;
+	}
+	return value - 1;
+}
+
+// Estimates ptr_src[0..index_src). Returns the total T-states, -1 on error.
+int z80_estimate()
+{
+    if (VERBOSE) printf("C: z80_estimate START. index_src (compressed_len): %d\n", index_src);
+	int subset = 0;
+	int end = index_src;
+	int decoded = 0;
+	int len, offset, bit, value;
+	int i;
+	long total = 0;
+
+	if (z80_region_size < Z80_REGION_MIN) z80_region_size = Z80_REGION_MIN;
+	memset(z80_region_cycles, 0, sizeof(z80_region_cycles));
+	z80_region_count = 0;
+	z80_region = 0;
+	index_src = 0;
+	bit_mask = 0;
+	bit_index = 0;
+	if (end <= 0) return 0;
+
+	z80_charge(Z80_SETUP, 1);
+	while ((bit = z80_bit(end)) != 0)
+	{
+		if (bit < 0 || ++subset > BIT_OFFSET_NBR) return -1;
+	}
+	if (z80_byte(end) < 0) return -1;
+	decoded = 1;
+
+	while (bit_mask != 0 || index_src < end)
+	{
+		if (decoded >= (MAX)) return -1;
+		z80_region = decoded / z80_region_size;
+		z80_charge(Z80_TOKEN, 1);
+		if ((bit = z80_bit(end)) < 0) return -1;
+		if (bit)
+		{
+			/* LITERAL */
+			if (index_src >= end) return -1;
+			read_byte();
+			z80_charge(Z80_LITERAL, 1);
+			decoded++;
+			continue;
+		}
+		len = z80_gamma(end);
+		if (len == -2) return -1;
+		if (len == -1)
+		{
+			if ((bit = z80_bit(end)) < 0) return -1;
+			if (bit == 0) break; /* END MARKER */
+			/* RLE */
+			if ((len = z80_byte(end)) < 0) return -1;
+			len++;
+			if (index_src + len > end || decoded + len > (MAX)) return -1;
+			index_src += len;
+			z80_charge(Z80_RLE_BYTE, len);
+			decoded += len;
+			continue;
+		}
+		/* MATCH */
+		offset = 0;
+		if ((bit = z80_bit(end)) < 0) return -1;
+		if (len == 1)
+		{
+			if (bit && (offset = z80_bit(end) + 1) == 0) return -1;
+		}
+		else if (!bit)
+		{
+			if ((value = z80_byte(end)) < 0) return -1;
+			offset = value + 32;
+		}
+		else
+		{
+			if ((bit = z80_bit(end)) < 0) return -1;
+			for (i = 0; i < (bit ? subset + BIT_OFFSET_MIN - 8 : 5); i++)
+			{
+				if ((value = z80_bit(end)) < 0) return -1;
+				offset = (offset << 1) | value;
+			}
+			if (bit)
+			{
+				if ((value = z80_byte(end)) < 0) return -1;
+				offset = (offset << 8 | value) + 256 + 32;
+			}
+		}
+		if (decoded - offset - 1 < 0 || decoded + len > (MAX))
+		{
+			if (VERBOSE) printf("C: ERROR: z80_estimate: Match at %d (offset %d, len %d) out of bounds!\n", decoded, offset, len);
+			return -1;
+		}
+		z80_charge(Z80_MATCH, 1);
+		z80_charge(Z80_MATCH_BYTE, len);
+		decoded += len;
+	}
+	z80_region_count = (decoded + z80_region_size - 1) / z80_region_size;
+	for (i = 0; i < z80_region_count; i++) total += z80_region_cycles[i];
+	if (total > 0x7FFFFFFF) total = 0x7FFFFFFF;
+    if (VERBOSE) printf("C: z80_estimate END. %d bytes, %ld T-states in %d regions\n", decoded, total, z80_region_count);
+	return (int) total;
+}
+
+/*
+ * - GRAPHICS TRANSFORMS -
+ * Reversible reorderings that lengthen matches in TMS9918 tables: the rows of
+ * 8x8 patterns sit 8 bytes apart and colour bytes hold two planes (fore and
+ * background nibbles). A transformed stream starts with 0xFF then 0x80|flags:
+ * nine 1 bits can never start a plain DAN3 header (at most BIT_OFFSET_NBR), so
+ * existing decoders reject it instead of producing garbage. Only dan3_decode
+ * undoes the transforms; in-place and streaming decoding do not apply.
+ * Flag STREAM_CRC32 (see CHECKSUM TRAILER) shares the byte and can come
+ * alone: every decoder checks such a stream. So does STREAM_SPLIT (see
+ * SPLIT STREAMS), for dan3_decode only.
+ * Forward order is stride, planes, delta; the inverse runs backwards. Bytes
+ * past the last whole group are left as they are.
+ */
+#define TRANSFORM_STRIDE	1 /* byte k of every 8-byte group together */
+#define TRANSFORM_PLANES	2 /* high nibbles, then low nibbles */
+#define TRANSFORM_DELTA		4 /* difference with the previous byte */
+#define TRANSFORM_ALL		7
+#define TRANSFORM_BEST		-1 /* try every combination and keep the smallest */
+#define TRANSFORM_HEADER	2
+
+// Flags of a transformed (or checksummed) stream, -1 for a plain DAN3 stream
+int transform_flags(uint8_t *data, int len)
+{
+	if (len < TRANSFORM_HEADER || data[0] != 0xFF || (data[1] & 0x80) == 0) return -1;
+	return data[1] & TRANSFORM_ALL;
+}
+
+int stream_split(uint8_t *data, int len)
+{
+	return (transform_flags(data, len) >= 0 && (data[1] & STREAM_SPLIT) != 0);
+}
+
+void stride_split(uint8_t *dst, uint8_t *src, int len, int inverse)
+{
+	int groups = len / 8;
+	int j, k;
+	for (j = 0; j < groups; j++)
+	{
+		for (k = 0; k < 8; k++)
+		{
+			if (inverse) dst[j * 8 + k] = src[k * groups + j];
+			else dst[k * groups + j] = src[j * 8 + k];
+		}
+	}
+	memcpy(dst + groups * 8, src + groups * 8, len - groups * 8);
+}
+
+void plane_split(uint8_t *dst, uint8_t *src, int len, int inverse)
+{
+	int pairs = len / 2;
+	int j;
+	for (j = 0; j < pairs; j++)
+	{
+		if (inverse)
+		{
+			dst[2 * j] = (src[j] & 0xF0) | (src[pairs + j] >> 4);
+			dst[2 * j + 1] = (src[j] << 4 & 0xF0) | (src[pairs + j] & 0x0F);
+		}
+		else
+		{
+			dst[j] = (src[2 * j] & 0xF0) | (src[2 * j + 1] >> 4);
+			dst[pairs + j] = (src[2 * j] << 4 & 0xF0) | (src[2 * j + 1] & 0x0F);
+		}
+	}
+	memcpy(dst + pairs * 2, src + pairs * 2, len - pairs * 2);
+}
+
+void delta_bytes(uint8_t *buf, int len, int inverse)
+{
+	int i;
+	if (inverse) for (i = 1; i < len; i++) buf[i] += buf[i - 1];
+	else for (i = len - 1; i > 0; i--) buf[i] -= buf[i - 1];
+}
+
+// Transforms buf (len bytes) in place, tmp holds len bytes of scratch
+void apply_transforms(uint8_t *buf, uint8_t *tmp, int len, int flags)
+{
+	if (flags & TRANSFORM_STRIDE)
+	{
+		stride_split(tmp, buf, len, FALSE);
+		memcpy(buf, tmp, len);
+	}
+	if (flags & TRANSFORM_PLANES)
+	{
+		plane_split(tmp, buf, len, FALSE);
+		memcpy(buf, tmp, len);
+	}
+	if (flags & TRANSFORM_DELTA) delta_bytes(buf, len, FALSE);
+}
+
+void undo_transforms(uint8_t *buf, uint8_t *tmp, int len, int flags)
+{
+	if (flags & TRANSFORM_DELTA) delta_bytes(buf, len, TRUE);
+	if (flags & TRANSFORM_PLANES)
+	{
+		plane_split(tmp, buf, len, TRUE);
+		memcpy(buf, tmp, len);
+	}
+	if (flags & TRANSFORM_STRIDE)
+	{
+		stride_split(tmp, buf, len, TRUE);
+		memcpy(buf, tmp, len);
+	}
+}
+
+/*
+ * - WRAPPER FUNCTIONS FOR JAVASCRIPT -
+ * These functions will be called from JavaScript via Emscripten.
+ * They point the codec (`ptr_src`, `ptr_dest`) at the buffers passed in, so
+ * the data is encoded/decoded in place without copying through `data_src`
+ * and `data_dest`. The output buffer must hold dan3_bound(input_len) bytes
+ * when encoding (dan3_encode_cap takes its size instead) and MAX bytes when
+ * decoding.
+ */
+// Function to set global compression options from JS
+EMSCRIPTEN_KEEPALIVE
+void set_dan3_options(int max_bits, int rle_enabled, int fast_mode) {
+    if (VERBOSE) printf("C: set_dan3_options called. max_bits=%d, rle=%d, fast=%d\n", max_bits, rle_enabled, fast_mode);
+    if (max_bits > BIT_OFFSET_MAX) max_bits = BIT_OFFSET_MAX;
+    if (max_bits < BIT_OFFSET_MIN) max_bits = BIT_OFFSET_MIN;
+    BIT_OFFSET_MAX_ALLOWED = max_bits;
+    BIT_OFFSET_NBR_ALLOWED = BIT_OFFSET_MAX_ALLOWED - BIT_OFFSET_MIN + 1;
+
+    bRLE = rle_enabled; // C's TRUE/FALSE are -1/0. JS boolean is 1/0.
+    bFAST = fast_mode;  // C's TRUE/FALSE are -1/0.
+    if (VERBOSE) printf("C: set_dan3_options: BIT_OFFSET_MAX_ALLOWED=%d, BIT_OFFSET_NBR_ALLOWED=%d, bRLE=%d, bFAST=%d\n",
+                           BIT_OFFSET_MAX_ALLOWED, BIT_OFFSET_NBR_ALLOWED, bRLE, bFAST);
+}
+
+// Threads used by the optimal parse (native build only, 1 = serial)
+EMSCRIPTEN_KEEPALIVE
+void set_dan3_threads(int threads) {
+    if (VERBOSE) printf("C: set_dan3_threads called. threads=%d\n", threads);
+    if (threads < 1) threads = 1;
+    nThreads = threads;
+}
+
+// Time budget of each encode in milliseconds, 0 = none (see TIME BUDGET)
+EMSCRIPTEN_KEEPALIVE
+void set_dan3_deadline(int ms) {
+    if (VERBOSE) printf("C: set_dan3_deadline called. ms=%d\n", ms);
+    deadline_ms = (ms > 0 ? ms : 0);
+}
+
+// CRC-32 trailer on the streams encoded from now on (see CHECKSUM TRAILER).
+// Decoding checks any stream that has one, whatever this says.
+EMSCRIPTEN_KEEPALIVE
+void set_dan3_checksum(int enabled) {
+    if (VERBOSE) printf("C: set_dan3_checksum called. enabled=%d\n", enabled);
+    bCRC = (enabled ? TRUE : FALSE);
+}
+
+// Split-stream layout for the streams encoded from now on (see SPLIT STREAMS)
+EMSCRIPTEN_KEEPALIVE
+void set_dan3_split(int enabled) {
+    if (VERBOSE) printf("C: set_dan3_split called. enabled=%d\n", enabled);
+    bSPLIT = (enabled ? TRUE : FALSE);
+}
+
+// Working memory cap of each encode in bytes, 0 = none (see MEMORY BUDGET)
+EMSCRIPTEN_KEEPALIVE
+void set_max_memory(int bytes) {
+    if (VERBOSE) printf("C: set_max_memory called. bytes=%d\n", bytes);
+    max_memory = (bytes > 0 ? bytes : 0);
+}
+
+// What the last encode ran with: MEMORY_FULL/RING/CHUNKED, parse threads,
+// positions per chunk, largest offset (window) and peak working memory
+EMSCRIPTEN_KEEPALIVE
+int get_memory_layout() {
+    return memory_layout;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_memory_threads() {
+    return memory_threads;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_memory_chunk() {
+    return memory_chunk;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_memory_window() {
+    return (1 << (BIT_OFFSET_MIN + subset_high)) + MAX_OFFSET2;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_memory_peak() {
+    return (int) memory_peak;
+}
+
+// Bytes the last encode needed when max_memory refused it, else 0
+EMSCRIPTEN_KEEPALIVE
+int get_memory_needed() {
+    return (int) memory_needed;
+}
+
+int dan3_bound(int input_len);
+
+// Points the encoder at the caller's buffers. The output must hold
+// dan3_bound(input_len) bytes: the encoders check the stream against that
+// size, or MAX when lower (the decoders take no longer stream), before
+// writing it. dan3_encode_cap lowers it to the caller's buffer.
+void set_encode_buffers(uint8_t* input_buf, int input_len, uint8_t* output_buf) {
+    // Work directly on the caller's buffers
+    ptr_src = input_buf;
+    size_src = input_len;
+    ptr_dest = output_buf;
+    size_dest = dan3_bound(input_len);
+    if (size_dest > MAX) size_dest = MAX;
+    index_src = input_len; // Set C's global index_src
+
+    // Reset bit counters before compression begins
+    bit_mask = 0;
+    bit_index = 0;
+}
+
+// dan3_encode into an output buffer of output_cap bytes: -1 when the stream
+// does not fit, and nothing is written past output_cap.
+EMSCRIPTEN_KEEPALIVE
+int dan3_encode_cap(uint8_t* input_buf, int input_len, uint8_t* output_buf, int output_cap) {
+    if (VERBOSE) printf("C: dan3_encode START. input_len=%d, input_buf=%p, output_buf=%p, output_cap=%d\n", input_len, (void*)input_buf, (void*)output_buf, output_cap);
+    // Ensure input_len doesn't exceed MAX
+    if (input_len > MAX) {
+        if (VERBOSE) printf("C: ERROR: dan3_encode input_len %d exceeds MAX %d\n", input_len, MAX);
+        return -1; // Indicate error
+    }
+
+    set_encode_buffers(input_buf, input_len, output_buf);
+    if (output_cap < size_dest) size_dest = (output_cap > 0 ? output_cap : 0);
+
+    // Call the original compression logic
+    int compressed_len = lzss_slow();
+
+    if (compressed_len >= 0) {
+        // Defensive check: Ensure compressed_len doesn't exceed output_buf's capacity
+        if (compressed_len > size_dest) {
+            if (VERBOSE) printf("C: ERROR: dan3_encode: compressed_len (%d) exceeds output_cap (%d) after lzss_slow!\n", compressed_len, size_dest);
+            return -1; // Indicates internal overflow
+        }
+        if (VERBOSE) printf("C: dan3_encode END. Returned compressed_len: %d\n", compressed_len);
+    } else {
+        if (VERBOSE) printf("C: dan3_encode END. lzss_slow returned error: %d\n", compressed_len);
+    }
+
+    return compressed_len;
+}
+
+// Wrapper for encode function
+// Takes input data, its length, and an output buffer pointer (of
+// dan3_bound(input_len) bytes). Returns the compressed length.
+EMSCRIPTEN_KEEPALIVE
+int dan3_encode(uint8_t* input_buf, int input_len, uint8_t* output_buf) {
+    return dan3_encode_cap(input_buf, input_len, output_buf, dan3_bound(input_len));
+}
+
+// Worst-case compressed size of input_len bytes: the parse never costs more
+// than the first byte raw plus 9-bit literals, with the longest header and the
+// end marker (and the CRC-32 header and trailer with bCRC). Enough for
+// dan3_encode's output buffer.
+EMSCRIPTEN_KEEPALIVE
+int dan3_bound(int input_len) {
+    if (input_len <= 0) return 0;
+    return (int) ((BIT_OFFSET_NBR + (long) input_len * 9 - 1 + 1 + BIT_GOLOMG_MAX + 1 + 7) / 8) + STREAM_FRAME;
+}
+
+// Exact size dan3_encode would return for this input, without walking the
+// path or writing any output. Same options, same cost as the parse alone.
+// With bSPLIT it can be a byte over: the padding of each stream is not known.
+EMSCRIPTEN_KEEPALIVE
+int dan3_predict_size(uint8_t* input_buf, int input_len) {
+    if (VERBOSE) printf("C: dan3_predict_size START. input_len=%d\n", input_len);
+    if (input_len > MAX) {
+        if (VERBOSE) printf("C: ERROR: dan3_predict_size input_len %d exceeds MAX %d\n", input_len, MAX);
+        return -1;
+    }
+    set_encode_buffers(input_buf, input_len, NULL);
+    bPREDICT = TRUE;
+    int predicted_len = lzss_slow();
+    bPREDICT = FALSE;
+    if (VERBOSE) printf("C: dan3_predict_size END. Predicted length: %d\n", predicted_len);
+    return predicted_len;
+}
+
+// Smallest stream over every max_bits/RLE/FAST combination, from one set of
+// match chains (the max_bits pruning keeps, see AUTO-TUNE). The chosen options stay set: get_BIT_OFFSET_MAX_ALLOWED,
+// get_bRLE and get_bFAST read them back. Returns the compressed length.
+EMSCRIPTEN_KEEPALIVE
+int dan3_autotune(uint8_t* input_buf, int input_len, uint8_t* output_buf) {
+    if (VERBOSE) printf("C: dan3_autotune START. input_len=%d\n", input_len);
+    if (input_len > MAX) {
+        if (VERBOSE) printf("C: ERROR: dan3_autotune input_len %d exceeds MAX %d\n", input_len, MAX);
+        return -1;
+    }
+    set_encode_buffers(input_buf, input_len, output_buf);
+    int compressed_len = lzss_autotune();
+    if (VERBOSE) printf("C: dan3_autotune END. Returned compressed_len: %d\n", compressed_len);
+    return compressed_len;
+}
+
+// Encode through the graphics transforms: flags is a TRANSFORM_* combination
+// (0: plain stream) or TRANSFORM_BEST. The output buffer needs TRANSFORM_HEADER
+// bytes more than for dan3_encode. Returns the compressed length.
+EMSCRIPTEN_KEEPALIVE
+int dan3_encode_transform(uint8_t* input_buf, int input_len, uint8_t* output_buf, int flags) {
+    if (VERBOSE) printf("C: dan3_encode_transform START. input_len=%d, flags=%d\n", input_len, flags);
+    if (input_len > MAX || flags < TRANSFORM_BEST || flags > TRANSFORM_ALL) {
+        if (VERBOSE) printf("C: ERROR: dan3_encode_transform invalid input_len %d or flags %d\n", input_len, flags);
+        return -1;
+    }
+    if (flags == 0 || input_len == 0) return dan3_encode(input_buf, input_len, output_buf);
+
+    // Transformed input, scratch for the transforms, and trial output
+    uint8_t *buf = (uint8_t *) malloc(input_len * 2 + dan3_bound(input_len));
+    if (buf == NULL) {
+        if (VERBOSE) printf("C: ERROR: dan3_encode_transform: no memory for %d bytes\n", input_len);
+        return -1;
+    }
+    uint8_t *tmp = buf + input_len;
+    int len;
+    if (flags == TRANSFORM_BEST) {
+        int best_len = dan3_encode(input_buf, input_len, tmp + input_len);
+        int f;
+        flags = 0;
+        for (f = 1; f <= TRANSFORM_ALL; f++) {
+            memcpy(buf, input_buf, input_len);
+            apply_transforms(buf, tmp, input_len, f);
+            len = dan3_encode(buf, input_len, tmp + input_len);
+            if (VERBOSE) printf("C: dan3_encode_transform: flags %d -> %d bytes\n", f, len);
+            if (len >= 0 && !bCRC && !bSPLIT) len += TRANSFORM_HEADER; // bCRC and bSPLIT streams have the header already
+            if (len >= 0 && (best_len < 0 || len < best_len)) {
+                best_len = len;
+                flags = f;
+            }
+        }
+    }
+    // Encode the winner again so tokens and margins describe the real output
+    if (flags == 0) {
+        len = dan3_encode(input_buf, input_len, output_buf);
+    } else {
+        memcpy(buf, input_buf, input_len);
+        apply_transforms(buf, tmp, input_len, flags);
+        if (bCRC || bSPLIT) {
+            len = dan3_encode(buf, input_len, output_buf);
+            if (len > 0) output_buf[1] |= flags;
+        } else if ((len = dan3_encode(buf, input_len, output_buf + TRANSFORM_HEADER)) >= 0) {
+            output_buf[0] = 0xFF;
+            output_buf[1] = 0x80 | flags;
+            len += TRANSFORM_HEADER;
+        }
+    }
+    free(buf);
+    if (VERBOSE) printf("C: dan3_encode_transform END. flags=%d, compressed_len=%d\n", flags, len);
+    return len;
+}
+
+/*
+ * Resumable encode, for callers that must not block (browser main thread
+ * without workers):
+ *     ctx = dan3_encode_begin(input, len, output);
+ *     while ((left = dan3_encode_step(ctx, budget)) > 0) { ...yield... }
+ * Each step scans up to budget more positions and returns how many are left,
+ * 0 once the output is written (dan3_encode_result gives its size), -1 on
+ * error. The codec state is per thread (DAN3_TLS): one resumable encode per
+ * thread, and nothing else may use the codec on that thread between steps;
+ * cancelling is just not stepping on.
+ */
+struct t_encoder
+{
+	int position;         /* next position to scan */
+	int prev_match_index; /* prefix key of the previous position */
+	int result;           /* compressed size, -1 on error */
+	int done;
+};
+DAN3_TLS struct t_encoder encoder;
+
+EMSCRIPTEN_KEEPALIVE
+struct t_encoder *dan3_encode_begin(uint8_t* input_buf, int input_len, uint8_t* output_buf) {
+    if (VERBOSE) printf("C: dan3_encode_begin. input_len=%d\n", input_len);
+    encoder.position = 1;
+    encoder.prev_match_index = -1;
+    encoder.result = -1;
+    encoder.done = TRUE;
+    if (input_len > MAX) {
+        if (VERBOSE) printf("C: ERROR: dan3_encode_begin input_len %d exceeds MAX %d\n", input_len, MAX);
+        return &encoder;
+    }
+    set_encode_buffers(input_buf, input_len, output_buf);
+    if (!lzss_prepare()) return &encoder;
+    encoder.result = lzss_init();
+    if (encoder.result <= 0) {
+        return &encoder; // Empty input (0) or out of memory (-1)
+    }
+    encoder.result = -1;
+    encoder.done = FALSE;
+    return &encoder;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int dan3_encode_step(struct t_encoder *ctx, int budget) {
+    int end;
+    if (ctx->done) return (ctx->result < 0 ? -1 : 0);
+    if (budget < 1) budget = 1;
+    end = (budget < index_src - ctx->position ? ctx->position + budget : index_src);
+    ctx->prev_match_index = lzss_scan(ctx->position, end, ctx->prev_match_index);
+    ctx->position = end;
+    if (end < index_src) return index_src - end;
+
+    ctx->result = lzss_finish();
+    if (ctx->result > MAX) ctx->result = -1;
+    ctx->done = TRUE;
+    if (VERBOSE) printf("C: dan3_encode_step: done, result %d\n", ctx->result);
+    return (ctx->result < 0 ? -1 : 0);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int dan3_encode_result(struct t_encoder *ctx) {
+    return ctx->result;
+}
+
+// Batch encode: many small inputs through the same codec state. Setup per
+// item is proportional to its size (buckets and table entries it uses), so
+// a 200-byte sprite no longer pays for clearing MAX entries.
+// output_lens[i] holds the capacity of outputs[i] on entry and the
+// compressed size (-1 on error) on return. Returns the number encoded.
+EMSCRIPTEN_KEEPALIVE
+int dan3_encode_batch(int count, uint8_t** inputs, int* input_lens, uint8_t** outputs, int* output_lens) {
+    if (VERBOSE) printf("C: dan3_encode_batch START. count=%d\n", count);
+    int i, ok = 0;
+    for (i = 0; i < count; i++) {
+        if (input_lens[i] > MAX) {
+            if (VERBOSE) printf("C: ERROR: dan3_encode_batch item %d: input_len %d exceeds MAX %d\n", i, input_lens[i], MAX);
+            output_lens[i] = -1;
+            continue;
+        }
+        set_encode_buffers(inputs[i], input_lens[i], outputs[i]);
+        if (output_lens[i] < size_dest) size_dest = output_lens[i];
+        output_lens[i] = lzss_slow();
+        if (output_lens[i] >= 0) ok++;
+    }
+    if (VERBOSE) printf("C: dan3_encode_batch END. %d/%d encoded\n", ok, count);
+    return ok;
+}
+
+// Wrapper for decode function
+// Takes compressed input data, its length, and an output buffer pointer.
+// Returns the decompressed length.
+EMSCRIPTEN_KEEPALIVE
+int dan3_decode(uint8_t* input_buf, int input_len, uint8_t* output_buf) {
+    if (VERBOSE) printf("C: dan3_decode START. input_len=%d, input_buf=%p, output_buf=%p\n", input_len, (void*)input_buf, (void*)output_buf);
+    // Ensure input_len doesn't exceed MAX
+    if (input_len > MAX) {
+        if (VERBOSE) printf("C: ERROR: dan3_decode input_len %d exceeds MAX %d\n", input_len, MAX);
+        return -1; // Indicate error
+    }
+    // Graphics transforms are undone once the stream is decoded
+    int flags = transform_flags(input_buf, input_len);
+    int split = stream_split(input_buf, input_len);
+    if (flags >= 0) {
+        crc_check = ((input_buf[1] & STREAM_CRC32) != 0);
+        input_buf += TRANSFORM_HEADER;
+        input_len -= TRANSFORM_HEADER;
+    }
+
+    // Work directly on the caller's buffers
+    ptr_src = input_buf;
+    size_src = input_len;
+    ptr_dest = output_buf;
+    size_dest = MAX;
+    index_src = input_len; // Set C's global index_src (for reading compressed data)
+
+    // Reset bit counters before decompression begins
+    bit_mask = 0;
+    bit_index = 0;
+
+    // Call the original decompression logic
+    int decompressed_len = (split ? delzss_split() : delzss());
+    crc_check = FALSE;
+
+    if (decompressed_len >= 0) {
+        // Defensive check: Ensure decompressed_len doesn't exceed output_buf's capacity (or original MAX if it's assumed)
+        // This implies index_dest should not exceed MAX within delzss
+        if (decompressed_len > MAX) {
+            if (VERBOSE) printf("C: ERROR: dan3_decode: decompressed_len (%d) exceeds MAX (%d) after delzss!\n", decompressed_len, MAX);
+            return -1; // Indicates internal overflow
+        }
+        if (flags > 0) {
+            uint8_t *tmp = (uint8_t *) malloc(decompressed_len + 1);
+            if (tmp == NULL) {
+                if (VERBOSE) printf("C: ERROR: dan3_decode: no memory to undo transforms %d\n", flags);
+                return -1;
+            }
+            undo_transforms(output_buf, tmp, decompressed_len, flags);
+            free(tmp);
+        }
+        if (VERBOSE) printf("C: dan3_decode END. Returned decompressed_len: %d\n", decompressed_len);
+    } else {
+        if (VERBOSE) printf("C: dan3_decode END. delzss returned error: %d\n", decompressed_len);
+    }
+
+    return decompressed_len;
+}
+
+// In-place decode: the compressed data (input_len bytes) sits at the tail of
+// buf, which holds buf_len bytes: at least the decompressed size plus the
+// inplace_margin reported by the encoder. Returns the decompressed length.
+EMSCRIPTEN_KEEPALIVE
+int dan3_decode_inplace(uint8_t* buf, int buf_len, int input_len) {
+    if (VERBOSE) printf("C: dan3_decode_inplace START. buf_len=%d, input_len=%d\n", buf_len, input_len);
+    if (input_len > buf_len || buf_len > MAX) {
+        if (VERBOSE) printf("C: ERROR: dan3_decode_inplace input_len %d / buf_len %d invalid\n", input_len, buf_len);
+        return -1;
+    }
+    inplace_base = buf_len - input_len;
+    int flags = transform_flags(buf + inplace_base, input_len);
+    if (flags > 0 || stream_split(buf + inplace_base, input_len)) {
+        if (VERBOSE) printf("C: ERROR: dan3_decode_inplace: graphics transforms %d or split streams need dan3_decode\n", flags);
+        inplace_base = -1;
+        return -1;
+    }
+    if (flags == 0) { // CRC-32 only
+        crc_check = TRUE;
+        inplace_base += CRC_HEADER;
+        input_len -= CRC_HEADER;
+    }
+    ptr_src = buf + inplace_base;
+    size_src = input_len;
+    ptr_dest = buf;
+    size_dest = buf_len;
+    index_src = input_len;
+    bit_mask = 0;
+    bit_index = 0;
+    int decompressed_len = delzss();
+    inplace_base = -1;
+    crc_check = FALSE;
+    if (VERBOSE) printf("C: dan3_decode_inplace END. Returned decompressed_len: %d\n", decompressed_len);
+    return decompressed_len;
+}
+
+// Streaming decode: output goes to sink(data, len, user) in chunks of
+// chunk_size bytes (<= 0: as large as the ring buffer allows), only the first
+// max_len bytes are decoded (< 0: all). Returns the number of bytes produced.
+EMSCRIPTEN_KEEPALIVE
+int dan3_decode_stream(uint8_t* input_buf, int input_len, t_dan3_sink sink, void *user, int chunk_size, int max_len) {
+    if (VERBOSE) printf("C: dan3_decode_stream START. input_len=%d, chunk_size=%d, max_len=%d\n", input_len, chunk_size, max_len);
+    if (input_len > MAX || sink == NULL) {
+        if (VERBOSE) printf("C: ERROR: dan3_decode_stream invalid input_len %d or sink\n", input_len);
+        return -1;
+    }
+    if (chunk_size <= 0 || chunk_size > RING_SIZE) chunk_size = RING_SIZE;
+    int flags = transform_flags(input_buf, input_len);
+    if (flags > 0 || stream_split(input_buf, input_len)) {
+        if (VERBOSE) printf("C: ERROR: dan3_decode_stream: graphics transforms %d or split streams need dan3_decode\n", flags);
+        return -1;
+    }
+    if (flags == 0) { // CRC-32 only
+        crc_check = TRUE;
+        input_buf += CRC_HEADER;
+        input_len -= CRC_HEADER;
+    }
+    ptr_src = input_buf;
+    size_src = input_len;
+    index_src = input_len;
+    stream_sink = sink;
+    stream_user = user;
+    stream_chunk = chunk_size;
+    int decompressed_len = delzss_stream(max_len);
+    crc_check = FALSE;
+    return decompressed_len;
+}
+
+// Estimated Z80 decode time of a compressed stream, in T-states (-1 on error).
+// Per-region sums are read back with get_z80_region_count/cycles.
+EMSCRIPTEN_KEEPALIVE
+int dan3_estimate_z80(uint8_t* input_buf, int input_len) {
+    if (VERBOSE) printf("C: dan3_estimate_z80 START. input_len=%d\n", input_len);
+    if (input_len > MAX) {
+        if (VERBOSE) printf("C: ERROR: dan3_estimate_z80 input_len %d exceeds MAX %d\n", input_len, MAX);
+        return -1;
+    }
+    if (stream_split(input_buf, input_len)) {
+        if (VERBOSE) printf("C: ERROR: dan3_estimate_z80: no estimate for split streams\n");
+        return -1;
+    }
+    if (transform_flags(input_buf, input_len) >= 0) { // The transforms are undone after decoding
+        input_buf += TRANSFORM_HEADER;
+        input_len -= TRANSFORM_HEADER;
+    }
+    ptr_src = input_buf;
+    size_src = input_len;
+    index_src = input_len;
+    return z80_estimate();
+}
+
+// Cost in T-states of one Z80_* event, and size of the estimate regions
+EMSCRIPTEN_KEEPALIVE
+void set_z80_cost(int event, int cycles) {
+    if (event >= 0 && event < Z80_COSTS && cycles >= 0) z80_costs[event] = cycles;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void set_z80_region_size(int bytes) {
+    z80_region_size = (bytes < Z80_REGION_MIN ? Z80_REGION_MIN : bytes);
+}
+
+// data_src for input_len bytes, data_dest for its encoding (transforms
+// included) or anything as long. FALSE when out of memory (see WORKING MEMORY).
+EMSCRIPTEN_KEEPALIVE
+int dan3_reserve(int input_len) {
+    if (VERBOSE) printf("C: dan3_reserve called. input_len=%d\n", input_len);
+    if (input_len < 1) input_len = 1;
+    if (input_len > MAX) return FALSE;
+    return grow_buffer((void **) &data_src, &data_src_capacity, input_len, 1)
+        && grow_buffer((void **) &data_dest, &data_dest_capacity, dan3_bound(input_len) + TRANSFORM_HEADER, 1);
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned char *get_data_src() {
+    return data_src;
+}
+
+EMSCRIPTEN_KEEPALIVE
+unsigned char *get_data_dest() {
+    return data_dest;
+}
+
+// Keeping original functions keepalive for direct internal testing if needed,
+// but the wrappers are preferred for JS interaction.
+// Note: These run the wrappers on data_src/data_dest, which JS fills directly
+// after dan3_reserve. decode() grows data_dest to MAX first.
+EMSCRIPTEN_KEEPALIVE int encode() {
+    if (index_src > data_src_capacity || !dan3_reserve(index_src)) return -1;
+    return dan3_encode(data_src, index_src, data_dest);
+}
+EMSCRIPTEN_KEEPALIVE int decode() {
+    if (!grow_buffer((void **) &data_dest, &data_dest_capacity, MAX, 1)) return -1;
+    return dan3_decode(data_src, index_src, data_dest);
+}
+
+// Keep set_max_bits_allowed keepalive if it's explicitly called from JS
+// (Though set_dan3_options replaces its functionality combined with flags)
+// It's fine to keep it for now.
+EMSCRIPTEN_KEEPALIVE void set_max_bits_allowed(int bits)
+{
+    if (VERBOSE) printf("C: set_max_bits_allowed called (legacy). bits=%d\n", bits);
+	if (bits > BIT_OFFSET_MAX) bits = BIT_OFFSET_MAX;
+	if (bits < BIT_OFFSET_MIN) bits = BIT_OFFSET_MIN;
+	BIT_OFFSET_MAX_ALLOWED = bits;
+	BIT_OFFSET_NBR_ALLOWED = BIT_OFFSET_MAX_ALLOWED - BIT_OFFSET_MIN + 1;
+}
+
+// --- Debugging getter functions ---
+EMSCRIPTEN_KEEPALIVE
+int get_optimal_bits(int index, int subset) {
+    if (index >= 0 && index < optimals_table_capacity && subset >= 0 && subset < BIT_OFFSET_NBR) {
+        return optimals_table[index].bits[subset];
+    }
+    // Return a distinguishable error value
+    return 0x7FFFFFFF; // Max signed 32-bit int, matches "Infinity" representation
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_optimal_offset(int index, int subset) {
+    if (index >= 0 && index < optimals_table_capacity && subset >= 0 && subset < BIT_OFFSET_NBR) {
+        return optimals_table[index].offset[subset];
+    }
+    return -1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_optimal_len(int index, int subset) {
+    if (index >= 0 && index < optimals_table_capacity && subset >= 0 && subset < BIT_OFFSET_NBR) {
+        return optimals_table[index].len[subset];
+    }
+    return -1;
+}
+
+// --- Analysis getters: the tokens of the last encode, in stream order ---
+EMSCRIPTEN_KEEPALIVE
+int get_token_count() {
+    return token_count;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_token_kind(int i) {
+    if (i >= 0 && i < token_count) {
+        return token_kind(&tokens[i]);
+    }
+    return -1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_token_len(int i) {
+    if (i >= 0 && i < token_count) {
+        return tokens[i].len;
+    }
+    return -1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_token_offset(int i) {
+    if (i >= 0 && i < token_count) {
+        return tokens[i].offset;
+    }
+    return -1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_token_offset_class(int i) {
+    if (i >= 0 && i < token_count) {
+        return token_offset_class(&tokens[i]);
+    }
+    return -1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_token_bits(int i) {
+    if (i >= 0 && i < token_count) {
+        return tokens[i].bits;
+    }
+    return -1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_z80_region_count() {
+    return z80_region_count;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_z80_region_cycles(int i) {
+    if (i >= 0 && i < z80_region_count) {
+        return z80_region_cycles[i];
+    }
+    return -1;
+}
+
+// Effort level (EFFORT_*) of each DEADLINE_REGION bytes of the last encode,
+// no regions without a time budget
+EMSCRIPTEN_KEEPALIVE
+int get_effort_region_count() {
+    return effort_region_count;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_effort_region(int i) {
+    if (i >= 0 && i < effort_region_count) {
+        return effort_regions[i];
+    }
+    return -1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_inplace_margin() {
+    return inplace_margin;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_bit_mask() {
+    return (int)bit_mask;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_bit_index() {
+    return bit_index;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_bFAST() {
+    return bFAST;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_bRLE() {
+    return bRLE;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_BIT_OFFSET3() {
+    return BIT_OFFSET3;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_MAX_OFFSET3() {
+    return MAX_OFFSET3;
+}
+
+// 1 in the -msimd128 build (dan3final_simd.js), 0 in the scalar one
+EMSCRIPTEN_KEEPALIVE
+int get_simd() {
+    return DAN3_VECTOR;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_BIT_OFFSET_MAX_ALLOWED() {
+    return BIT_OFFSET_MAX_ALLOWED;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int get_BIT_OFFSET_NBR_ALLOWED() {
+    return BIT_OFFSET_NBR_ALLOWED;
+}
+
+/*
+ * - NATIVE COMMAND LINE TOOL -
+ * (The WASM build leaves file handling to the JavaScript environment)
+ * Input files are memory-mapped read-only and handed to the codec as ptr_src.
+ * The output file is created at its worst-case size, mapped, written in place
+ * through ptr_dest and truncated to the final length: nothing is copied
+ * through data_src/data_dest.
+ */
+#if !defined(__EMSCRIPTEN__) && !defined(DAN3_LIBRARY)
+struct t_mapped
+{
+	int fd;
+	unsigned char *data;
+	long size;
+};
+
+#define CORRUPT_ROUNDS	200 /* Default of dan3 -u (see CORRUPT INPUT TEST) */
+
+void help(void)
+{
+	printf("%s %s - %s %s\n", PRGTITLE, VERSION, YEAR, AUTHOR);
+	printf("USAGE: dan3 [-options] file(s)\n");
+	printf("  -h        this help\n");
+	printf("  -a        try all offset sizes (no subset pruning)\n");
+	printf("  -b        benchmark (encode, then decode repeatedly)\n");
+	printf("  -c        decompress to standard output (streaming)\n");
+	printf("  -d        decompress (%s -> %s)\n", EXTENSION, EXTENSIONBIN);
+	printf("  -e<ms>    finish each encode within ms milliseconds (less effort\n");
+	printf("            on the regions that would not fit)\n");
+	printf("  -f        fast mode\n");
+	printf("  -g[n]     graphics transforms: %d stride, %d planes, %d delta (sum them),\n", TRANSFORM_STRIDE, TRANSFORM_PLANES, TRANSFORM_DELTA);
+	printf("            or try all and keep the best when n is omitted\n");
+	printf("  -i        add a CRC-32 of the data, checked when decompressing\n");
+	printf("  -r        disable RLE\n");
+	printf("  -s        show where the bits go (per token kind)\n");
+	printf("  -t[n]     parse with n threads (default: all cores)\n");
+	printf("  -l        low memory mode (rolling cost table)\n");
+	printf("  -k<kb>    keep the working memory of each encode under kb KB\n");
+	printf("            (smaller tables, chunked backtrack, then a smaller window;\n");
+	printf("            at least 306 KB of fixed tables plus 4 bytes per input byte)\n");
+	printf("  -o        auto-tune: smallest output over -m, -r and -f\n");
+	printf("            (the -m that subset pruning keeps, all of them with -a)\n");
+	printf("  -p        print the compressed size only (no output file)\n");
+	printf("  -m<bits>  maximum bits to encode offsets (%d..%d)\n", BIT_OFFSET_MIN, BIT_OFFSET_MAX);
+	printf("  -n        exhaustive parse (no branch and bound, same output, slower)\n");
+	printf("  -v        verbose\n");
+	printf("  -u[n]     decode n truncated and n bit-flipped copies of each file\n");
+	printf("            (default %d): corrupt input must fail cleanly\n", CORRUPT_ROUNDS);
+	printf("  -w        worst-case benchmark (runs, periodic data)\n");
+	printf("  -x        split streams (control bits, gammas, bytes) for fast\n");
+	printf("            decoders; with -b, compared with the classic stream\n");
+	printf("  -z[t[:n]] estimate Z80 decode time; fail if a region of n bytes\n");
+	printf("            (default %d) takes more than t T-states\n", z80_region_size);
+	printf("  -y        overwrite files without asking\n");
+	printf("  --serve[=socket] encoder server: length-prefixed requests on stdin (or\n");
+	printf("            the Unix socket), served by -t<n> worker processes\n");
+}
+
+int file_exits(char *filename)
+{
+	struct stat st;
+	return (stat(filename, &st) == 0);
+}
+
+int yesno()
+{
+	int c = getchar();
+	int answer = (tolower(c) == 'y');
+	while (c != '\n' && c != EOF) c = getchar();
+	return (answer ? TRUE : FALSE);
+}
+
+int ask_overwrite(char *filename)
+{
+	if (bYes || !file_exits(filename)) return TRUE;
+	printf("%s already exists. Overwrite (y/n)? ", filename);
+	return yesno();
+}
+
+char *newfilepathLZ(char* filepath)
+{
+	char *newpath = (char *) malloc(strlen(filepath) + strlen(EXTENSION) + 1);
+	if (newpath == NULL) return NULL;
+	strcpy(newpath, filepath);
+	strcat(newpath, EXTENSION);
+	return newpath;
+}
+
+char *newfilepathRAW(char* filepath)
+{
+	size_t len = strlen(filepath);
+	char *newpath = (char *) malloc(len + strlen(EXTENSIONBIN) + 1);
+	if (newpath == NULL) return NULL;
+	strcpy(newpath, filepath);
+	if (len > strlen(EXTENSION) && strcmp(filepath + len - strlen(EXTENSION), EXTENSION) == 0)
+	{
+		newpath[len - strlen(EXTENSION)] = '\0';
+	}
+	strcat(newpath, EXTENSIONBIN);
+	return newpath;
+}
+
+/*
+ * - MAP INPUT FILE (READ ONLY) -
+ */
+int map_input(char *filename, struct t_mapped *map)
+{
+	struct stat st;
+	map->data = NULL;
+	map->fd = open(filename, O_RDONLY);
+	if (map->fd < 0 || fstat(map->fd, &st) != 0)
+	{
+		printf("%s: cannot open file\n", filename);
+		if (map->fd >= 0) close(map->fd);
+		return -1;
+	}
+	map->size = (long) st.st_size;
+	if (map->size > MAX)
+	{
+		printf("%s: file too big (%ld bytes, maximum %d)\n", filename, map->size, MAX);
+		close(map->fd);
+		return -1;
+	}
+	if (map->size > 0)
+	{
+		map->data = (unsigned char *) mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, map->fd, 0);
+		if (map->data == MAP_FAILED)
+		{
+			printf("%s: cannot map file\n", filename);
+			close(map->fd);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * - MAP OUTPUT FILE (PREALLOCATED TO CAPACITY) -
+ */
+int map_output(char *filename, long capacity, struct t_mapped *map)
+{
+	map->data = NULL;
+	map->size = capacity;
+	map->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (map->fd < 0 || ftruncate(map->fd, capacity) != 0)
+	{
+		printf("%s: cannot create file\n", filename);
+		if (map->fd >= 0) close(map->fd);
+		return -1;
+	}
+	map->data = (unsigned char *) mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+	if (map->data == MAP_FAILED)
+	{
+		printf("%s: cannot map file\n", filename);
+		close(map->fd);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * - UNMAP FILE - (final_size >= 0 truncates an output file to its real length)
+ */
+void unmap_file(struct t_mapped *map, long final_size)
+{
+	if (map->data != NULL) munmap(map->data, map->size);
+	if (final_size >= 0 && ftruncate(map->fd, final_size) != 0)
+	{
+		printf("Output error\n");
+	}
+	close(map->fd);
+}
+
+/*
+ * - COMPRESS OR DECOMPRESS ONE FILE -
+ */
+/*
+ * - WHERE THE BITS GO - (token list of the last encode, per kind and offset class)
+ */
+int bStats = FALSE;
+
+void print_token_stats()
+{
+	static const char *names[] = { "literal", "RLE", "match, 1 byte", "match, short offset", "match, 8-bit offset", "match, long offset" };
+	long count[6] = { 0 }, bytes[6] = { 0 }, bits[6] = { 0 };
+	long total = 0;
+	int i, c;
+
+	for (i = 0; i < token_count; i++)
+	{
+		c = (token_kind(&tokens[i]) == TOKEN_MATCH ? 1 + token_offset_class(&tokens[i]) : token_kind(&tokens[i]));
+		count[c]++;
+		bytes[c] += tokens[i].len;
+		bits[c] += tokens[i].bits;
+		total += tokens[i].bits;
+	}
+	printf("  %-20s %8s %8s %9s %6s %9s\n", "kind", "tokens", "bytes", "bits", "share", "bits/byte");
+	for (c = 0; c < 6; c++)
+	{
+		if (count[c] == 0) continue;
+		printf("  %-20s %8ld %8ld %9ld %5.1f%% %9.2f\n", names[c], count[c], bytes[c], bits[c],
+			100.0 * bits[c] / total, (double) bits[c] / bytes[c]);
+	}
+	printf("  %-20s %8s %8s %9d\n", "header + end marker", "", "", BIT_OFFSET3 - BIT_OFFSET_MIN + 1 + 1 + BIT_GOLOMG_MAX + 1);
+}
+
+/*
+ * - Z80 DECODE TIME - (estimate of the stream, worst region against a budget)
+ */
+#define Z80_FRAME	59719.0 /* T-states per NTSC frame (3.579545 MHz / 59.94 Hz) */
+
+int bZ80 = FALSE;
+int z80_budget = 0; /* T-states allowed per region, 0 = no limit */
+
+int print_z80_estimate(int total)
+{
+	int i, worst = 0;
+
+	if (total < 0)
+	{
+		printf("  Z80 estimate: invalid stream\n");
+		return -1;
+	}
+	for (i = 1; i < z80_region_count; i++)
+	{
+		if (z80_region_cycles[i] > z80_region_cycles[worst]) worst = i;
+	}
+	printf("  Z80 decode ~%d T-states (%.2f frames), worst %d-byte region #%d: %d T-states (%.2f frames)\n",
+		total, total / Z80_FRAME, z80_region_size, worst, z80_region_cycles[worst], z80_region_cycles[worst] / Z80_FRAME);
+	if (z80_budget > 0 && z80_region_cycles[worst] > z80_budget)
+	{
+		printf("  Z80 budget of %d T-states per region exceeded\n", z80_budget);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * - GRAPHICS TRANSFORMS - (0: none, TRANSFORM_BEST: try them all)
+ */
+int transform = 0;
+int bAutotune = FALSE;
+
+/*
+ * - TIME BUDGET - (effort level of the regions of the last encode)
+ */
+void print_effort_regions()
+{
+	static const char *names[] = { "full", "shallow", "narrow", "greedy" };
+	int count[4] = { 0 };
+	int i;
+
+	for (i = 0; i < get_effort_region_count(); i++) count[get_effort_region(i)]++;
+	printf("  time budget %d ms, %d-byte regions:", deadline_ms, DEADLINE_REGION);
+	for (i = 0; i < 4; i++) printf(" %d %s", count[i], names[i]);
+	printf("\n");
+}
+
+/*
+ * - MEMORY BUDGET - (settings and peak of the last encode)
+ */
+void print_memory_plan()
+{
+	static const char *names[] = { "full cost table", "cost ring", "cost ring, chunked back-pointers" };
+
+	printf("  memory: %s", names[get_memory_layout()]);
+	if (get_memory_layout() == MEMORY_CHUNKED) printf(" (%d positions per chunk)", get_memory_chunk());
+	printf(", offsets up to %d bits (window %d), %d thread%s, peak %d KB of %d KB\n",
+		BIT_OFFSET_MIN + subset_high, get_memory_window(), get_memory_threads(), get_memory_threads() > 1 ? "s" : "",
+		(get_memory_peak() + 1023) / 1024, max_memory / 1024);
+}
+
+void print_memory_needed(char *filename)
+{
+	printf("%s: compression failed, needs -k%d at least (-k%d given)\n", filename,
+		(get_memory_needed() + 1023) / 1024, max_memory / 1024);
+}
+
+int process_file(char *filename, int bDecompress)
+{
+	struct t_mapped in, out;
+	char *outname;
+	long capacity;
+	int len, z80_total = 0, flags = -1;
+
+	if (map_input(filename, &in) != 0) return -1;
+	outname = (bDecompress ? newfilepathRAW(filename) : newfilepathLZ(filename));
+	if (outname == NULL || !ask_overwrite(outname))
+	{
+		unmap_file(&in, -1);
+		free(outname);
+		return (outname == NULL ? -1 : 0);
+	}
+	capacity = (bDecompress ? MAX : dan3_bound((int) in.size) + TRANSFORM_HEADER);
+	if (map_output(outname, capacity, &out) != 0)
+	{
+		unmap_file(&in, -1);
+		free(outname);
+		return -1;
+	}
+	len = (bDecompress ? dan3_decode(in.data, (int) in.size, out.data) : (bAutotune ? dan3_autotune(in.data, (int) in.size, out.data) : dan3_encode_transform(in.data, (int) in.size, out.data, transform)));
+	if (!bDecompress && len > 0) flags = transform_flags(out.data, len);
+	if (bZ80 && len >= 0) z80_total = (bDecompress ? dan3_estimate_z80(in.data, (int) in.size) : dan3_estimate_z80(out.data, len));
+	unmap_file(&in, -1);
+	unmap_file(&out, len < 0 ? 0 : len);
+	if (len < 0)
+	{
+		if (!bDecompress && get_memory_needed() > 0) print_memory_needed(filename);
+		else printf("%s: %s failed\n", filename, bDecompress ? "decompression" : "compression");
+		remove(outname);
+		free(outname);
+		return -1;
+	}
+	if (bDecompress) printf("%s: %ld -> %d bytes (%s)\n", filename, in.size, len, outname);
+	else if (inplace_margin < 0) printf("%s: %ld -> %d bytes (%s), split streams\n", filename, in.size, len, outname);
+	else printf("%s: %ld -> %d bytes (%s), in-place margin %d\n", filename, in.size, len, outname, inplace_margin);
+	if (bAutotune && !bDecompress) printf("  auto-tune: -m%d%s%s\n", BIT_OFFSET_MAX_ALLOWED, bRLE ? "" : " -r", bFAST ? " -f" : "");
+	if (flags > 0) printf("  graphics transforms:%s%s%s\n", (flags & TRANSFORM_STRIDE) ? " stride" : "",
+		(flags & TRANSFORM_PLANES) ? " planes" : "", (flags & TRANSFORM_DELTA) ? " delta" : "");
+	if (bStats && !bDecompress) print_token_stats();
+	if (deadline_ms > 0 && !bDecompress) print_effort_regions();
+	if (max_memory > 0 && !bDecompress) print_memory_plan();
+	free(outname);
+	return (bZ80 ? print_z80_estimate(z80_total) : 0);
+}
+
+/*
+ * - DECOMPRESS ONE FILE TO STANDARD OUTPUT - (streaming, no output buffer)
+ */
+void sink_file(const uint8_t *data, int len, void *user)
+{
+	if (fwrite(data, 1, len, (FILE *) user) != (size_t) len) fprintf(stderr, "Output error\n");
+}
+
+int stream_file(char *filename)
+{
+	struct t_mapped in;
+	int len;
+
+	if (map_input(filename, &in) != 0) return -1;
+	len = dan3_decode_stream(in.data, (int) in.size, sink_file, stdout, 0, -1);
+	unmap_file(&in, -1);
+	fflush(stdout);
+	if (len < 0)
+	{
+		fprintf(stderr, "%s: decompression failed\n", filename);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * - PREDICT THE COMPRESSED SIZE OF ONE FILE - (no output file)
+ */
+int predict_file(char *filename)
+{
+	struct t_mapped in;
+	int len;
+
+	if (map_input(filename, &in) != 0) return -1;
+	len = dan3_predict_size(in.data, (int) in.size);
+	unmap_file(&in, -1);
+	if (len < 0)
+	{
+		if (get_memory_needed() > 0) print_memory_needed(filename);
+		else printf("%s: compression failed\n", filename);
+		return -1;
+	}
+	printf("%s: %ld -> %d bytes (predicted, bound %d)\n", filename, in.size, len, dan3_bound((int) in.size));
+	return 0;
+}
+
+/*
+ * - BENCHMARK ONE FILE - (encode once, decode repeatedly for half a second)
+ * With -x the tokens of the classic stream are also written as split streams
+ * and both decoders are timed on them.
+ */
+double elapsed_ms(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// Average decode time in ms; the output is compared with the input
+double bench_decode(struct t_mapped *in, unsigned char *packed, int len, unsigned char *unpacked, int *match)
+{
+	struct timespec start;
+	double decode_ms;
+	int unpacked_len, runs = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do
+	{
+		unpacked_len = dan3_decode(packed, len, unpacked);
+		runs++;
+	}
+	while ((decode_ms = elapsed_ms(&start)) < 500.0 && len > 0);
+	*match = (unpacked_len == in->size && (in->size == 0 || memcmp(unpacked, in->data, in->size) == 0));
+	return decode_ms / runs;
+}
+
+int bench_file(char *filename)
+{
+	struct t_mapped in;
+	struct timespec start;
+	unsigned char *packed, *unpacked;
+	double encode_ms, decode_ms, split_ms;
+	int len, split_len, match, split = bSPLIT, bound;
+
+	if (map_input(filename, &in) != 0) return -1;
+	bSPLIT = TRUE; // The larger frame: room for either stream
+	bound = dan3_bound((int) in.size);
+	bSPLIT = split;
+	packed = (unsigned char *) malloc(2 * (size_t) bound + 1);
+	unpacked = (unsigned char *) malloc(MAX);
+	if (packed == NULL || unpacked == NULL)
+	{
+		printf("%s: out of memory\n", filename);
+		free(packed);
+		free(unpacked);
+		unmap_file(&in, -1);
+		return -1;
+	}
+	bSPLIT = FALSE;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	len = dan3_encode(in.data, (int) in.size, packed);
+	encode_ms = elapsed_ms(&start);
+	decode_ms = bench_decode(&in, packed, len, unpacked, &match);
+	printf("%s: %ld -> %d bytes, encode %.1f ms, decode %.3f ms (%.1f MB/s)%s\n",
+		filename, in.size, len, encode_ms, decode_ms, in.size / (decode_ms * 1000.0), match ? "" : " MISMATCH");
+	if (split && len > 0)
+	{
+		bSPLIT = TRUE;
+		set_encode_buffers(in.data, (int) in.size, packed + bound);
+		split_len = write_split(BIT_OFFSET3 - BIT_OFFSET_MIN);
+		split_ms = bench_decode(&in, packed + bound, split_len, unpacked, &match);
+		printf("%s: split streams %d bytes (%+d), decode %.3f ms (%.1f MB/s, %.2fx)%s\n",
+			filename, split_len, split_len - len, split_ms, in.size / (split_ms * 1000.0), decode_ms / split_ms, match ? "" : " MISMATCH");
+	}
+	bSPLIT = split;
+	free(packed);
+	free(unpacked);
+	unmap_file(&in, -1);
+	return 0;
+}
+
+/*
+ * - WORST-CASE BENCHMARK - (runs and periodic data: encode time must stay linear)
+ * Each pattern is encoded at growing sizes; the time per byte of the largest
+ * size may not exceed WORST_SLACK times the one of the smallest.
+ */
+#define WORST_SIZES	3
+#define WORST_SLACK	2.5
+
+int bench_worst()
+{
+	static const int periods[] = { 1, 2, 7, 300 }; /* 1: a single run */
+	static const int sizes[WORST_SIZES] = { 8192, 32768, 131072 };
+	struct timespec start;
+	unsigned char *in, *packed;
+	double us_per_byte[WORST_SIZES];
+	int p, k, x, len;
+	int errors = 0;
+
+	in = (unsigned char *) malloc(sizes[WORST_SIZES - 1]);
+	packed = (unsigned char *) malloc(dan3_bound(sizes[WORST_SIZES - 1]));
+	if (in == NULL || packed == NULL)
+	{
+		printf("out of memory\n");
+		free(in);
+		free(packed);
+		return -1;
+	}
+	for (p = 0; p < (int) (sizeof(periods) / sizeof(periods[0])); p++)
+	{
+		for (x = 0; x < sizes[WORST_SIZES - 1]; x++) in[x] = (unsigned char) ((x % periods[p]) * 37);
+		for (k = 0; k < WORST_SIZES; k++)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			len = dan3_encode(in, sizes[k], packed);
+			us_per_byte[k] = elapsed_ms(&start) * 1000.0 / sizes[k];
+			printf("period %3d: %6d -> %5d bytes, encode %8.1f ms (%.2f us/byte)\n",
+				periods[p], sizes[k], len, us_per_byte[k] * sizes[k] / 1000.0, us_per_byte[k]);
+		}
+		if (us_per_byte[WORST_SIZES - 1] > WORST_SLACK * us_per_byte[0])
+		{
+			printf("period %3d: NOT LINEAR (%.2f us/byte at %d bytes, %.2f at %d)\n", periods[p],
+				us_per_byte[WORST_SIZES - 1], sizes[WORST_SIZES - 1], us_per_byte[0], sizes[0]);
+			errors++;
+		}
+	}
+	free(in);
+	free(packed);
+	return (errors ? -1 : 0);
+}
+
+/*
+ * - CORRUPT INPUT TEST - (dan3 -u[n] file(s))
+ * Each file is encoded with the current options, then n truncated and n
+ * bit-flipped copies go through every decoder, each copy in a buffer of its
+ * exact size. A decoder must return -1 or a size that fits its output, and
+ * with -i every truncated copy must be rejected. Run it on the release build,
+ * whose decoders have no per-byte checks, with AddressSanitizer so that any
+ * read past the input stops the test:
+ *   cc -O1 -g -fsanitize=address -DDAN3_RELEASE -pthread -o dan3 dan3final.c
+ * The copies come from a fixed seed: a failure is reproduced by rerunning.
+ */
+void sink_count(const uint8_t *data, int len, void *user)
+{
+	(void) data;
+	*(long *) user += len;
+}
+
+// -1 if a decoder accepted a copy it had to reject or returned a bad size
+int corrupt_decode(unsigned char *copy, int len, unsigned char *unpacked, long size, int truncated, int *rejected)
+{
+	unsigned char *buf;
+	long streamed = 0;
+	int result, must_fail = (truncated && bCRC && len >= CRC_HEADER); // Shorter: an empty or plain stream
+	int errors = 0;
+
+	result = dan3_decode(copy, len, unpacked);
+	if (result < 0) (*rejected)++;
+	if (result > MAX || (must_fail && result >= 0)) errors++;
+	result = dan3_decode_stream(copy, len, sink_count, &streamed, 0, -1);
+	if ((result >= 0 && result != streamed) || (must_fail && result >= 0)) errors++;
+	dan3_estimate_z80(copy, len);
+	// In-place: the copy ends where the buffer ends
+	buf = (unsigned char *) malloc(size + len + 1);
+	if (buf == NULL) return -1;
+	memcpy(buf + size + 1, copy, len);
+	result = dan3_decode_inplace(buf, (int) (size + len + 1), len);
+	if (result > size + len + 1 || (must_fail && result >= 0)) errors++;
+	free(buf);
+	return (errors ? -1 : 0);
+}
+
+int corrupt_file(char *filename, int rounds)
+{
+	struct t_mapped in;
+	unsigned char *packed, *unpacked, *copy;
+	uint32_t seed = 2463534242u;
+	int len, r, k, cut;
+	int rejected = 0, errors = 0;
+
+	if (map_input(filename, &in) != 0) return -1;
+	packed = (unsigned char *) malloc(dan3_bound((int) in.size) + TRANSFORM_HEADER);
+	unpacked = (unsigned char *) malloc(MAX);
+	if (packed == NULL || unpacked == NULL)
+	{
+		printf("%s: out of memory\n", filename);
+		free(packed);
+		free(unpacked);
+		unmap_file(&in, -1);
+		return -1;
+	}
+	len = dan3_encode_transform(in.data, (int) in.size, packed, transform);
+	if (len <= 0 || dan3_decode(packed, len, unpacked) != (int) in.size || memcmp(unpacked, in.data, in.size) != 0)
+	{
+		printf("%s: round trip failed before any damage\n", filename);
+		errors++;
+		rounds = 0;
+	}
+	for (r = 0; r < 2 * rounds; r++)
+	{
+		// Even rounds: the first cut bytes. Odd rounds: 1 to 3 bits flipped.
+		cut = (r & 1 ? len : (int) ((long) (r / 2) * len / rounds));
+		copy = (unsigned char *) malloc(cut > 0 ? cut : 1);
+		if (copy == NULL) break;
+		memcpy(copy, packed, cut);
+		for (k = 0; (r & 1) && k < 3; k++)
+		{
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			if (k == 0 || (seed & 0x300) != 0) copy[(seed >> 3) % len] ^= (unsigned char) (1 << (seed & 7));
+		}
+		if (corrupt_decode(copy, cut, unpacked, (long) in.size, !(r & 1), &rejected) != 0)
+		{
+			printf("%s: copy %d (%s %d bytes) decoded wrongly\n", filename, r, r & 1 ? "bit-flipped," : "first", cut);
+			errors++;
+		}
+		free(copy);
+	}
+	printf("%s: %d bytes, %d damaged copies, %d rejected by dan3_decode, %d errors\n", filename, len, 2 * rounds, rejected, errors);
+	free(packed);
+	free(unpacked);
+	unmap_file(&in, -1);
+	return (errors ? -1 : 0);
+}
+
+/*
+ * - ENCODER SERVER - (dan3 --serve[=socket])
+ * Build tools send one request per asset instead of starting dan3 each time.
+ * All integers are 32-bit little-endian.
+ *   request:  size (bytes after this field), id, command ('e' encode,
+ *             'd' decode), max_bits (0: -m of the server), flags (SERVE_*),
+ *             transform (TRANSFORM_* sum, 255: best) as one byte each,
+ *             deadline in ms (0: none), then size - 12 bytes of input
+ *   response: size, id, result (output length, -1 on error), codec time in
+ *             microseconds, then size - 12 bytes of output
+ * Each encoder context is a worker process, so a request that crashes the
+ * codec takes only its worker down. A worker serves requests one after the
+ * other and keeps its buffers grown from one to the next (see WORKING
+ * MEMORY). -t<n> sets the number of workers. On stdin/stdout the server
+ * hands each request to an idle worker and writes the responses as they
+ * complete: match them by id. A worker that dies is replaced and its request
+ * answered with result -1. On a Unix socket the workers accept the
+ * connections themselves.
+ */
+#define SERVE_HEADER	12
+#define SERVE_NO_RLE	1
+#define SERVE_FAST		2
+#define SERVE_AUTOTUNE	4
+#define SERVE_CRC32		8 /* CRC-32 trailer (always with dan3 -i --serve) */
+#define SERVE_WORKERS	64 /* at most */
+
+struct t_worker
+{
+	pid_t pid;
+	int fd;
+	int busy;
+	unsigned char id[4]; /* of the request in flight */
+};
+
+uint32_t get_le32(const unsigned char *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+void put_le32(unsigned char *p, uint32_t value)
+{
+	p[0] = (unsigned char) value;
+	p[1] = (unsigned char) (value >> 8);
+	p[2] = (unsigned char) (value >> 16);
+	p[3] = (unsigned char) (value >> 24);
+}
+
+// FALSE on end of file or error
+int read_full(int fd, unsigned char *buf, long len)
+{
+	long n;
+	while (len > 0)
+	{
+		n = read(fd, buf, len);
+		if (n <= 0) return FALSE;
+		buf += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+int write_full(int fd, const unsigned char *buf, long len)
+{
+	long n;
+	while (len > 0)
+	{
+		n = write(fd, buf, len);
+		if (n <= 0) return FALSE;
+		buf += n;
+		len -= n;
+	}
+	return TRUE;
+}
+
+// Reads one message (size field included) into *buf. Returns its length,
+// 0 at end of input, -1 when malformed.
+long read_message(int fd, unsigned char **buf, int *capacity)
+{
+	unsigned char size[4];
+	uint32_t len;
+
+	if (!read_full(fd, size, 4)) return 0;
+	len = get_le32(size);
+	if (len < SERVE_HEADER || len > SERVE_HEADER + (uint32_t) dan3_bound(MAX) + TRANSFORM_HEADER) return -1;
+	if (!grow_buffer((void **) buf, capacity, 4 + len, 1)) return -1;
+	memcpy(*buf, size, 4);
+	return (read_full(fd, *buf + 4, len) ? 4 + (long) len : -1);
+}
+
+// One worker: requests from in_fd, responses to out_fd, until end of input
+int serve_requests(int in_fd, int out_fd, int max_bits)
+{
+	unsigned char *request = NULL, *response = NULL;
+	int request_capacity = 0, response_capacity = 0;
+	int len, input_len, flags, result;
+	int crc = bCRC;
+	unsigned char *header;
+	double start;
+	long n;
+
+	while ((n = read_message(in_fd, &request, &request_capacity)) > 0)
+	{
+		header = request + 4;
+		input_len = (int) (n - 4 - SERVE_HEADER);
+		flags = header[6];
+		len = (header[4] == 'd' ? MAX : dan3_bound(input_len) + TRANSFORM_HEADER);
+		if (!grow_buffer((void **) &response, &response_capacity, 4 + SERVE_HEADER + len, 1)) break;
+		set_dan3_options(header[5] ? header[5] : max_bits, (flags & SERVE_NO_RLE) ? FALSE : TRUE, (flags & SERVE_FAST) ? TRUE : FALSE);
+		set_dan3_deadline((int) get_le32(header + 8));
+		set_dan3_checksum(crc || (flags & SERVE_CRC32));
+		start = now_ms();
+		if (input_len > MAX) result = -1;
+		else if (header[4] == 'd') result = dan3_decode(header + SERVE_HEADER, input_len, response + 4 + SERVE_HEADER);
+		else if (header[4] != 'e') result = -1;
+		else if (flags & SERVE_AUTOTUNE) result = dan3_autotune(header + SERVE_HEADER, input_len, response + 4 + SERVE_HEADER);
+		else result = dan3_encode_transform(header + SERVE_HEADER, input_len, response + 4 + SERVE_HEADER,
+			header[7] == 255 ? TRANSFORM_BEST : header[7] & TRANSFORM_ALL);
+		len = (result > 0 ? result : 0);
+		put_le32(response, SERVE_HEADER + len);
+		memcpy(response + 4, header, 4); // id
+		put_le32(response + 8, (uint32_t) result);
+		put_le32(response + 12, (uint32_t) ((now_ms() - start) * 1000.0));
+		if (!write_full(out_fd, response, 4 + SERVE_HEADER + len)) break;
+	}
+	free(request);
+	free(response);
+	return (n < 0 ? -1 : 0);
+}
+
+// Worker process k, connected to the dispatcher by a socket pair. FALSE if
+// it cannot be started.
+int start_worker(struct t_worker *workers, int k, int count, int max_bits)
+{
+	int j, fds[2];
+
+	workers[k].fd = -1;
+	workers[k].busy = FALSE;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return FALSE;
+	workers[k].pid = fork();
+	if (workers[k].pid == 0)
+	{
+		close(fds[0]);
+		for (j = 0; j < count; j++) if (j != k && workers[j].fd >= 0) close(workers[j].fd);
+		exit(serve_requests(fds[1], fds[1], max_bits) != 0 ? 1 : 0);
+	}
+	close(fds[1]);
+	if (workers[k].pid < 0)
+	{
+		close(fds[0]);
+		return FALSE;
+	}
+	workers[k].fd = fds[0];
+	return TRUE;
+}
+
+int start_workers(struct t_worker *workers, int count, int max_bits)
+{
+	int k;
+
+	for (k = 0; k < count; k++) workers[k].fd = -1;
+	for (k = 0; k < count; k++) if (!start_worker(workers, k, count, max_bits)) return k;
+	return count;
+}
+
+// Worker k died or hung up with a request: answer it with result -1, then
+// start a new worker in its place, as serve_socket does
+int restart_worker(struct t_worker *workers, int k, int count, int max_bits)
+{
+	unsigned char response[4 + SERVE_HEADER];
+
+	if (VERBOSE) printf("C: serve_stdio: worker %d exited, restarting it\n", (int) workers[k].pid);
+	close(workers[k].fd);
+	waitpid(workers[k].pid, NULL, 0);
+	memset(response, 0, sizeof(response));
+	put_le32(response, SERVE_HEADER);
+	memcpy(response + 4, workers[k].id, 4);
+	put_le32(response + 8, (uint32_t) -1);
+	return (write_full(1, response, sizeof(response)) && start_worker(workers, k, count, max_bits));
+}
+
+// Requests from stdin spread over the idle workers, responses to stdout
+int serve_stdio(int count, int max_bits)
+{
+	struct t_worker workers[SERVE_WORKERS];
+	struct pollfd fds[SERVE_WORKERS + 1];
+	unsigned char *message = NULL;
+	int capacity = 0;
+	int k, n, polled, idle, eof = FALSE, errors = 0;
+	long len;
+
+	if (count < 1) count = 1; // Even one worker keeps a crash away from the dispatcher
+	if (count > SERVE_WORKERS) count = SERVE_WORKERS;
+	count = start_workers(workers, count, max_bits);
+	if (count == 0) return serve_requests(0, 1, max_bits);
+	for (;;)
+	{
+		n = 0;
+		idle = -1;
+		for (k = 0; k < count; k++)
+		{
+			if (workers[k].busy)
+			{
+				fds[n].fd = workers[k].fd;
+				fds[n++].events = POLLIN;
+			}
+			else if (idle < 0) idle = k;
+		}
+		if (!eof && idle >= 0)
+		{
+			fds[n].fd = 0;
+			fds[n++].events = POLLIN;
+		}
+		if (n == 0) break; // End of input, every response written
+		polled = n;
+		if (poll(fds, polled, -1) < 0) break;
+		for (k = 0; k < count; k++)
+		{
+			if (!workers[k].busy) continue;
+			for (n = 0; fds[n].fd != workers[k].fd; n++);
+			if (!(fds[n].revents & (POLLIN | POLLHUP))) continue;
+			len = read_message(workers[k].fd, &message, &capacity);
+			if (len <= 0)
+			{
+				if (!restart_worker(workers, k, count, max_bits)) errors++;
+			}
+			else if (!write_full(1, message, len)) errors++;
+			workers[k].busy = FALSE;
+		}
+		if (!eof && idle >= 0 && fds[polled - 1].fd == 0 && (fds[polled - 1].revents & (POLLIN | POLLHUP)))
+		{
+			len = read_message(0, &message, &capacity);
+			if (len <= 0)
+			{
+				if (len < 0) errors++;
+				eof = TRUE;
+			}
+			else
+			{
+				memcpy(workers[idle].id, message + 4, 4);
+				if (write_full(workers[idle].fd, message, len)) workers[idle].busy = TRUE;
+				else if (!restart_worker(workers, idle, count, max_bits)) errors++;
+			}
+		}
+		if (errors) break;
+	}
+	for (k = 0; k < count; k++) if (workers[k].fd >= 0) close(workers[k].fd);
+	for (k = 0; k < count; k++) if (workers[k].fd >= 0) waitpid(workers[k].pid, NULL, 0);
+	free(message);
+	return (errors ? -1 : 0);
+}
+
+pid_t socket_workers[SERVE_WORKERS];
+int socket_worker_count = 0;
+char *socket_path = NULL;
+
+// SIGTERM/SIGINT: the workers go with the server, and so does the socket
+void stop_socket_workers(int sig)
+{
+	int k;
+	for (k = 0; k < socket_worker_count; k++) kill(socket_workers[k], SIGTERM);
+	unlink(socket_path);
+	_exit(sig == SIGTERM ? 0 : 1);
+}
+
+// Workers sharing the listening socket, replaced if one dies
+int serve_socket(char *path, int count, int max_bits)
+{
+	struct sockaddr_un address;
+	pid_t pid;
+	int listener, conn, k, status;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		printf("%s: socket path too long\n", path);
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path);
+	if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+	{
+		printf("%s: cannot listen\n", path);
+		return -1;
+	}
+	if (count < 1) count = 1;
+	if (count > SERVE_WORKERS) count = SERVE_WORKERS;
+	socket_path = path;
+	signal(SIGTERM, stop_socket_workers);
+	signal(SIGINT, stop_socket_workers);
+	for (k = 0; ; )
+	{
+		if (socket_worker_count >= count)
+		{
+			// Pool full: wait for a worker to die, then replace it
+			pid = wait(&status);
+			if (pid < 0) break;
+			if (VERBOSE) printf("C: serve_socket: worker %d exited, restarting it\n", (int) pid);
+			for (k = 0; socket_workers[k] != pid && k < socket_worker_count - 1; k++);
+		}
+		else k = socket_worker_count++;
+		pid = fork();
+		if (pid < 0) break;
+		socket_workers[k] = pid;
+		if (pid == 0)
+		{
+			signal(SIGTERM, SIG_DFL);
+			signal(SIGINT, SIG_DFL);
+			for (;;)
+			{
+				conn = accept(listener, NULL, NULL);
+				if (conn < 0) continue;
+				serve_requests(conn, conn, max_bits);
+				close(conn);
+			}
+		}
+	}
+	stop_socket_workers(SIGINT);
+	return -1;
+}
+
+int serve(char *path, int count, int max_bits)
+{
+	signal(SIGPIPE, SIG_IGN); // A client gone: write fails, the worker goes on
+	set_dan3_threads(1); // Parallelism comes from the workers
+	return (path != NULL ? serve_socket(path, count, max_bits) : serve_stdio(count, max_bits));
+}
+
+int main(int argc, char *argv[])
+{
+	int i;
+	int bDecompress = FALSE;
+	int bStdout = FALSE;
+	int bBench = FALSE;
+	int bPredict = FALSE;
+	int bWorst = FALSE;
+	int corrupt_rounds = 0;
+	int max_bits = BIT_OFFSET_MAX;
+	int threads = 1;
+	int bServe = FALSE;
+	char *serve_path = NULL;
+	int nfiles = 0;
+	int errors = 0;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-') continue;
+		switch (tolower(argv[i][1]))
+		{
+			case 'a': bPRUNE = FALSE; break;
+			case 'b': bBench = TRUE; break;
+			case 'c': bStdout = TRUE; break;
+			case 'd': bDecompress = TRUE; break;
+			case 'e': set_dan3_deadline(atoi(argv[i] + 2)); break;
+			case 'f': bFAST = TRUE; break;
+			case 'g': transform = (argv[i][2] ? atoi(argv[i] + 2) & TRANSFORM_ALL : TRANSFORM_BEST); break;
+			case 'i': set_dan3_checksum(TRUE); break;
+			case 'x': set_dan3_split(TRUE); break;
+			case 'r': bRLE = FALSE; break;
+			case 's': bStats = TRUE; break;
+			case 't':
+				threads = atoi(argv[i] + 2);
+				if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+				break;
+			case 'l': bLOWMEM = TRUE; break;
+			case 'o': bAutotune = TRUE; break;
+			case 'p': bPredict = TRUE; break;
+			case 'm': max_bits = atoi(argv[i] + 2); break;
+			case 'k': set_max_memory(atoi(argv[i] + 2) * 1024); break;
+			case 'n': bBOUND = FALSE; break;
+			case 'v': bVerbose = TRUE; break;
+			case 'u':
+				corrupt_rounds = atoi(argv[i] + 2);
+				if (corrupt_rounds <= 0) corrupt_rounds = CORRUPT_ROUNDS;
+				break;
+			case 'w': bWorst = TRUE; break;
+			case 'z':
+				bZ80 = TRUE;
+				z80_budget = atoi(argv[i] + 2);
+				if (strchr(argv[i], ':') != NULL) set_z80_region_size(atoi(strchr(argv[i], ':') + 1));
+				break;
+			case 'y': bYes = TRUE; break;
+			case '-':
+				if (strncmp(argv[i], "--serve", 7) == 0 && (argv[i][7] == '\0' || argv[i][7] == '='))
+				{
+					bServe = TRUE;
+					serve_path = (argv[i][7] == '=' ? argv[i] + 8 : NULL);
+					break;
+				}
+				help();
+				return 0;
+			default: help(); return 0;
+		}
+	}
+	set_dan3_options(max_bits, bRLE, bFAST);
+	set_dan3_threads(threads);
+	if (bServe) return (serve(serve_path, threads, max_bits) != 0 ? 1 : 0);
+	if (bWorst) return (bench_worst() != 0 ? 1 : 0);
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-') continue;
+		nfiles++;
+		if (corrupt_rounds > 0)
+		{
+			if (corrupt_file(argv[i], corrupt_rounds) != 0) errors++;
+		}
+		else if (bBench)
+		{
+			if (bench_file(argv[i]) != 0) errors++;
+		}
+		else if (bPredict)
+		{
+			if (predict_file(argv[i]) != 0) errors++;
+		}
+		else if ((bStdout ? stream_file(argv[i]) : process_file(argv[i], bDecompress)) != 0) errors++;
+	}
+	if (nfiles == 0) help();
+	return (errors ? 1 : 0);
+}
+#endif
@@ -0,0 +1,80 @@
+// DAN3 WASM startup benchmark
+// node bench-startup.js [-n runs] [module.js ...]
+// Times what index.html reports as "ready in": from createDan3Module() to a
+// module that has encoded a first small input, then the linear memory it
+// holds. Each run loads the script again, so every instantiation is a cold
+// one. Default modules: dan3final.js and dan3final_simd.js next to this file.
+// A module older than dan3final.c (no C_ABI) is not measured: rebuild it
+// first (npm run build:wasm, npm run build:wasm-simd).
+// Checked-in modules on Node 20, one core, -n 50: ready in about 21 ms
+// median (14-17 ms best), 2.0 MB, scalar and SIMD alike.
+'use strict';
+
+const fs = require('fs');
+const path = require('path');
+
+const DAN3_ABI = 3; // C_ABI of the dan3final.c this file was written for
+const SAMPLE = Buffer.from('DAN3 startup benchmark, DAN3 startup benchmark\n'.repeat(64));
+
+function median(values) {
+    const sorted = values.slice().sort((a, b) => a - b);
+    return sorted[sorted.length >> 1];
+}
+
+// One cold start: ms to ready, MB of memory, or null when the build is stale
+async function startOnce(file) {
+    delete require.cache[require.resolve(file)];
+    const start = process.hrtime.bigint();
+    const m = await require(file)();
+    if (!m._C_ABI || m.HEAP32[m._C_ABI >> 2] !== DAN3_ABI) return null;
+    const inPtr = m._malloc(SAMPLE.length);
+    const outPtr = m._malloc(m._dan3_bound(SAMPLE.length));
+    m.HEAPU8.set(SAMPLE, inPtr);
+    m._set_dan3_options(16, -1, 0);
+    const size = m._dan3_encode(inPtr, SAMPLE.length, outPtr);
+    const ms = Number(process.hrtime.bigint() - start) / 1e6;
+    m._free(inPtr);
+    m._free(outPtr);
+    if (size <= 0) throw new Error(file + ': encode failed');
+    return { ms, mb: m.HEAPU8.length / (1024 * 1024) };
+}
+
+async function main() {
+    const args = process.argv.slice(2);
+    let runs = 20;
+    const files = [];
+    for (let i = 0; i < args.length; i++) {
+        if (args[i] === '-n') runs = Math.max(1, args[++i] | 0);
+        else files.push(path.resolve(args[i]));
+    }
+    if (files.length === 0) {
+        for (const name of ['dan3final.js', 'dan3final_simd.js']) {
+            const file = path.join(__dirname, name);
+            if (fs.existsSync(file)) files.push(file);
+        }
+    }
+    let rc = 0;
+    for (const file of files) {
+        const times = [];
+        let mb = 0;
+        for (let i = 0; i < runs; i++) {
+            const result = await startOnce(file);
+            if (result === null) break;
+            times.push(result.ms);
+            mb = result.mb;
+        }
+        if (times.length === 0) {
+            console.log(`${path.basename(file)}: older than dan3final.c (no C_ABI ${DAN3_ABI}), rebuild it first`);
+            rc = 1;
+            continue;
+        }
+        console.log(`${path.basename(file)}: ready in ${median(times).toFixed(1)} ms median, `
+            + `${Math.min(...times).toFixed(1)} ms best (${runs} runs), ${mb.toFixed(1)} MB`);
+    }
+    process.exitCode = rc;
+}
+
+main().catch((e) => {
+    console.error(e.message);
+    process.exitCode = 1;
+});
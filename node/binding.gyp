@@ -0,0 +1,11 @@
+{
+  "targets": [
+    {
+      "target_name": "dan3",
+      "sources": [ "dan3_node.c", "../dan3final.c" ],
+      "defines": [ "DAN3_LIBRARY", "DAN3_RELEASE" ],
+      "cflags": [ "-O2", "-fvisibility=hidden" ],
+      "msvs_settings": { "VCCLCompilerTool": { "Optimization": 2 } }
+    }
+  ]
+}
@@ -0,0 +1,204 @@
+/* DAN3 Node.js addon
+ * ------------
+ * encode(buffer, maxBits, rle, fast, transform, checksum, split) and decode(buffer) return
+ * Promises and run on the libuv thread pool, so the event loop never waits
+ * for the codec. The input Buffer (or any Uint8Array) is read in place, kept
+ * alive by a reference until the job is done, and the output is handed to
+ * JavaScript as an external Buffer: nothing is copied either way.
+ * The codec state is thread-local in dan3final.c (DAN3_TLS), so the jobs run
+ * side by side, one per pool thread: each thread keeps its own match chains
+ * and cost table (several MB after a large encode, reused by its next job).
+ * Build: node-gyp rebuild (binding.gyp compiles ../dan3final.c with
+ * DAN3_LIBRARY). index.js falls back to the WASM build without it.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <node_api.h>
+#include <uv.h>
+
+/* From dan3final.c */
+extern const int C_MAX;
+int dan3_encode(uint8_t* input_buf, int input_len, uint8_t* output_buf);
+int dan3_encode_transform(uint8_t* input_buf, int input_len, uint8_t* output_buf, int flags);
+int dan3_decode(uint8_t* input_buf, int input_len, uint8_t* output_buf);
+int dan3_bound(int input_len);
+void set_dan3_options(int max_bits, int rle_enabled, int fast_mode);
+void set_dan3_checksum(int enabled);
+void set_dan3_split(int enabled);
+
+#define TRANSFORM_HEADER	2 /* Bytes a transformed stream adds (see GRAPHICS TRANSFORMS) */
+
+/*
+ * - ONE ENCODE OR DECODE -
+ */
+struct t_job
+{
+	napi_async_work work;
+	napi_deferred deferred;
+	napi_ref input_ref;
+	uint8_t *input;
+	size_t input_len;
+	uint8_t *output;
+	int result;
+	int decode;
+	int max_bits, rle, fast, transform, checksum, split;
+};
+
+static void free_output(napi_env env, void *data, void *hint)
+{
+	free(data);
+}
+
+// Thread pool: no JavaScript values here
+static void execute_job(napi_env env, void *data)
+{
+	struct t_job *job = (struct t_job *) data;
+
+	job->result = -1;
+	if (job->input_len > (size_t) C_MAX) return;
+	job->output = (uint8_t *) malloc(job->decode ? C_MAX : dan3_bound((int) job->input_len) + TRANSFORM_HEADER);
+	if (job->output == NULL) return;
+	if (job->decode)
+	{
+		job->result = dan3_decode(job->input, (int) job->input_len, job->output);
+	}
+	else
+	{
+		set_dan3_options(job->max_bits, job->rle ? -1 : 0, job->fast ? -1 : 0);
+		set_dan3_checksum(job->checksum);
+		set_dan3_split(job->split);
+		job->result = (job->transform != 0 ? dan3_encode_transform(job->input, (int) job->input_len, job->output, job->transform)
+			: dan3_encode(job->input, (int) job->input_len, job->output));
+	}
+	if (job->result > 0)
+	{
+		// Give back the unused capacity (a decode buffer holds C_MAX bytes)
+		uint8_t *output = (uint8_t *) realloc(job->output, job->result);
+		if (output != NULL) job->output = output;
+	}
+}
+
+// Main thread: settle the promise
+static void complete_job(napi_env env, napi_status status, void *data)
+{
+	struct t_job *job = (struct t_job *) data;
+	napi_value value, message;
+
+	napi_delete_reference(env, job->input_ref);
+	if (status != napi_ok || job->result < 0)
+	{
+		free(job->output);
+		napi_create_string_utf8(env, job->decode ? "DAN3 decode failed" : "DAN3 encode failed", NAPI_AUTO_LENGTH, &message);
+		napi_create_error(env, NULL, message, &value);
+		napi_reject_deferred(env, job->deferred, value);
+	}
+	else
+	{
+		if (job->result == 0)
+		{
+			free(job->output);
+			napi_create_buffer(env, 0, NULL, &value);
+		}
+		else if (napi_create_external_buffer(env, job->result, job->output, free_output, NULL, &value) != napi_ok)
+		{
+			// Runtimes without external buffers get a copy
+			napi_create_buffer_copy(env, job->result, job->output, NULL, &value);
+			free(job->output);
+		}
+		napi_resolve_deferred(env, job->deferred, value);
+	}
+	napi_delete_async_work(env, job->work);
+	free(job);
+}
+
+static int get_int_arg(napi_env env, napi_value *args, size_t argc, size_t i, int value)
+{
+	napi_valuetype type;
+	int32_t arg;
+
+	if (i >= argc || napi_typeof(env, args[i], &type) != napi_ok) return value;
+	if (type == napi_number && napi_get_value_int32(env, args[i], &arg) == napi_ok) return arg;
+	if (type == napi_boolean)
+	{
+		bool flag;
+		if (napi_get_value_bool(env, args[i], &flag) == napi_ok) return flag;
+	}
+	return value;
+}
+
+static napi_value start_job(napi_env env, napi_callback_info info, int decode)
+{
+	napi_value args[7], promise, name;
+	size_t argc = 7;
+	napi_typedarray_type type;
+	size_t offset;
+	napi_value arraybuffer;
+	bool is_typedarray = false;
+	struct t_job *job;
+
+	napi_get_cb_info(env, info, &argc, args, NULL, NULL);
+	if (argc >= 1) napi_is_typedarray(env, args[0], &is_typedarray);
+	if (!is_typedarray)
+	{
+		napi_throw_type_error(env, NULL, "DAN3: expected a Buffer or Uint8Array");
+		return NULL;
+	}
+	job = (struct t_job *) calloc(1, sizeof(struct t_job));
+	if (job == NULL)
+	{
+		napi_throw_error(env, NULL, "DAN3: out of memory");
+		return NULL;
+	}
+	napi_get_typedarray_info(env, args[0], &type, &job->input_len, (void **) &job->input, &arraybuffer, &offset);
+	if (type != napi_uint8_array && type != napi_uint8_clamped_array && type != napi_int8_array)
+	{
+		free(job);
+		napi_throw_type_error(env, NULL, "DAN3: expected a Buffer or Uint8Array");
+		return NULL;
+	}
+	job->decode = decode;
+	job->max_bits = get_int_arg(env, args, argc, 1, 16);
+	job->rle = get_int_arg(env, args, argc, 2, 1);
+	job->fast = get_int_arg(env, args, argc, 3, 0);
+	job->transform = get_int_arg(env, args, argc, 4, 0);
+	job->checksum = get_int_arg(env, args, argc, 5, 0);
+	job->split = get_int_arg(env, args, argc, 6, 0);
+	napi_create_reference(env, args[0], 1, &job->input_ref);
+	napi_create_promise(env, &job->deferred, &promise);
+	napi_create_string_utf8(env, decode ? "dan3.decode" : "dan3.encode", NAPI_AUTO_LENGTH, &name);
+	napi_create_async_work(env, NULL, name, execute_job, complete_job, job, &job->work);
+	napi_queue_async_work(env, job->work);
+	return promise;
+}
+
+static napi_value encode(napi_env env, napi_callback_info info)
+{
+	return start_job(env, info, 0);
+}
+
+static napi_value decode(napi_env env, napi_callback_info info)
+{
+	return start_job(env, info, 1);
+}
+
+static napi_value bound(napi_env env, napi_callback_info info)
+{
+	napi_value args[1], value;
+	size_t argc = 1;
+
+	napi_get_cb_info(env, info, &argc, args, NULL, NULL);
+	napi_create_int32(env, dan3_bound(get_int_arg(env, args, argc, 0, 0)), &value);
+	return value;
+}
+
+NAPI_MODULE_INIT()
+{
+	napi_property_descriptor properties[] = {
+		{ "encode", NULL, encode, NULL, NULL, NULL, napi_enumerable, NULL },
+		{ "decode", NULL, decode, NULL, NULL, NULL, napi_enumerable, NULL },
+		{ "bound", NULL, bound, NULL, NULL, NULL, napi_enumerable, NULL },
+	};
+
+	napi_define_properties(env, exports, sizeof(properties) / sizeof(properties[0]), properties);
+	return exports;
+}
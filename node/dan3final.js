@@ -0,0 +1,49 @@
+// Loader for dan3final.wasm (dan3final.c built for wasm32, -DDAN3_RELEASE, with clang
+// and wasm-ld; npm run build:wasm rebuilds both files with emcc)
+// createDan3Module(moduleArg) -> Promise of the module: exports as _name
+// (functions, and addresses for data), HEAPU8 and HEAP32 views that follow
+// memory growth. moduleArg: locateFile, wasmBinary, onRuntimeInitialized.
+var createDan3Module = (() => {
+  var _scriptName = typeof document != 'undefined' ? document.currentScript?.src : undefined;
+  if (typeof __filename != 'undefined') _scriptName = __filename;
+  else if (typeof WorkerGlobalScope != 'undefined') _scriptName = self.location.href;
+  return async function(moduleArg = {}) {
+    var Module = moduleArg;
+    var isNode = typeof process == 'object' && process.versions?.node && process.type != 'renderer';
+    var scriptDirectory = isNode ? __dirname + '/' : (_scriptName ? new URL('.', _scriptName).href : '');
+    var file = Module['locateFile'] ? Module['locateFile']('dan3final.wasm', scriptDirectory) : scriptDirectory + 'dan3final.wasm';
+    var binary = Module['wasmBinary'];
+    if (!binary) {
+      if (isNode) binary = require('fs').readFileSync(file.startsWith('file://') ? new URL(file) : file);
+      else {
+        var response = await fetch(file, { credentials: 'same-origin' });
+        if (!response.ok) throw new Error('failed to load ' + file + ': ' + response.status);
+        binary = await response.arrayBuffer();
+      }
+    }
+    var now = typeof performance != 'undefined' ? () => performance.now() : () => Date.now();
+    var { instance } = await WebAssembly.instantiate(binary, { env: { emscripten_get_now: now } });
+    var memory = instance.exports.memory, u8, i32;
+    function views() {
+      if (!u8 || u8.buffer !== memory.buffer) {
+        u8 = new Uint8Array(memory.buffer);
+        i32 = new Int32Array(memory.buffer);
+      }
+    }
+    Object.defineProperty(Module, 'HEAPU8', { get() { views(); return u8; }, configurable: true });
+    Object.defineProperty(Module, 'HEAP32', { get() { views(); return i32; }, configurable: true });
+    Module['wasmMemory'] = memory;
+    for (var name in instance.exports) {
+      var value = instance.exports[name];
+      if (value instanceof WebAssembly.Global) Module['_' + name] = value.value;
+      else if (typeof value == 'function') Module['_' + name] = value;
+    }
+    Module['calledRun'] = true;
+    Module['onRuntimeInitialized']?.();
+    return Module;
+  };
+})();
+if (typeof exports === 'object' && typeof module === 'object') {
+  module.exports = createDan3Module;
+  module.exports.default = createDan3Module;
+}
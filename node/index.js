@@ -0,0 +1,136 @@
+// DAN3 for Node.js
+// encode(buffer, { maxBits, rle, fast, transform, checksum, split }) and decode(buffer) return
+// Promises of Buffers. The native addon (dan3_node.c) does the work on the
+// libuv thread pool; without it (no compiler at install time) the WASM build
+// dan3final.js is used instead (dan3final_simd.js where WASM SIMD is available),
+// on the main thread. checksum adds a CRC-32 of the data to the stream;
+// decode rejects a stream whose CRC-32 does not match. split writes the
+// control bits, gammas and bytes as separate streams, faster to decode.
+'use strict';
+
+const TRANSFORM_BEST = -1;
+const DAN3_ABI = 3; // C_ABI of the dan3final.c this file was written for
+
+let native = null;
+try {
+    native = require('./build/Release/dan3.node');
+} catch (e) {
+    native = null;
+}
+
+function checkInput(buffer) {
+    if (!(buffer instanceof Uint8Array)) throw new TypeError('DAN3: expected a Buffer or Uint8Array');
+}
+
+function transformFlags(transform) {
+    if (transform === 'best') return TRANSFORM_BEST;
+    return transform | 0;
+}
+
+// - WASM FALLBACK -
+// dan3final_simd.js (built with -msimd128, npm run build:wasm-simd) when the
+// runtime validates a v128 instruction and the module is current, the scalar
+// dan3final.js otherwise.
+// A module built from an older dan3final.c (no C_ABI, or another value) is
+// refused: its stream format and exports may not match this file.
+const SIMD_PROBE = new Uint8Array([0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0,
+    10, 10, 1, 8, 0, 65, 0, 253, 15, 253, 98, 11]); // i8x16.splat, i8x16.popcnt
+let wasm = null;
+
+function wasmSimd() {
+    try {
+        return WebAssembly.validate(SIMD_PROBE);
+    } catch (e) {
+        return false;
+    }
+}
+
+function wasmAbi(m) {
+    return m._C_ABI ? m.HEAP32[m._C_ABI >> 2] : 0;
+}
+
+async function createWasm() {
+    if (wasmSimd()) {
+        let create = null;
+        try {
+            create = require('./dan3final_simd.js');
+        } catch (e) {
+            create = null;
+        }
+        if (create) {
+            const m = await create();
+            // Not a current -msimd128 build: the scalar one below
+            if (wasmAbi(m) === DAN3_ABI && m._get_simd() !== 0) return m;
+        }
+    }
+    const m = await require('./dan3final.js')();
+    if (wasmAbi(m) !== DAN3_ABI) {
+        throw new Error('DAN3: dan3final.js is older than dan3final.c (C_ABI ' + wasmAbi(m) + ', expected '
+            + DAN3_ABI + '), rebuild it with emcc (see WASM build in dan3final.c) or build the native addon');
+    }
+    return m;
+}
+
+function loadWasm() {
+    if (wasm === null) wasm = createWasm();
+    return wasm;
+}
+
+async function wasmRun(buffer, decode, opts) {
+    const m = await loadWasm();
+    const cMax = m.HEAP32[m._C_MAX >> 2];
+    if (buffer.length > cMax) throw new Error('DAN3: input too large');
+    const inPtr = m._malloc(buffer.length || 1);
+    const outLen = decode ? cMax : m._dan3_bound(buffer.length) + 2;
+    const outPtr = m._malloc(outLen);
+    try {
+        m.HEAPU8.set(buffer, inPtr);
+        let size;
+        if (decode) {
+            size = m._dan3_decode(inPtr, buffer.length, outPtr);
+        } else {
+            m._set_dan3_options(opts.maxBits, opts.rle ? -1 : 0, opts.fast ? -1 : 0);
+            m._set_dan3_checksum(opts.checksum ? -1 : 0);
+            m._set_dan3_split(opts.split ? -1 : 0);
+            size = (opts.transform !== 0 ? m._dan3_encode_transform(inPtr, buffer.length, outPtr, opts.transform)
+                : m._dan3_encode(inPtr, buffer.length, outPtr));
+        }
+        if (size < 0) throw new Error(decode ? 'DAN3 decode failed' : 'DAN3 encode failed');
+        return Buffer.from(m.HEAPU8.slice(outPtr, outPtr + size));
+    } finally {
+        m._free(inPtr);
+        m._free(outPtr);
+    }
+}
+
+// - API -
+function encode(buffer, options) {
+    const o = options || {};
+    const opts = {
+        maxBits: o.maxBits === undefined ? 16 : o.maxBits | 0,
+        rle: o.rle === undefined ? true : !!o.rle,
+        fast: !!o.fast,
+        transform: transformFlags(o.transform),
+        checksum: !!o.checksum,
+        split: !!o.split,
+    };
+    try {
+        checkInput(buffer);
+    } catch (e) {
+        return Promise.reject(e);
+    }
+    if (native) return native.encode(buffer, opts.maxBits, opts.rle, opts.fast, opts.transform, opts.checksum, opts.split);
+    return wasmRun(buffer, false, opts);
+}
+
+function decode(buffer) {
+    try {
+        checkInput(buffer);
+    } catch (e) {
+        return Promise.reject(e);
+    }
+    if (native) return native.decode(buffer);
+    return wasmRun(buffer, true, null);
+}
+
+module.exports = { encode, decode, native: native !== null };